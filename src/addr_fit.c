@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "memana.h"
+
+#define dp(p) printf(#p " = %p\n", (p))
+#define dd(d) printf(#d " = %I64d\n", (d))
+#define ABS(size) ((size) >= 0 ? (size) : -(size))
+
+// 按地址排序的首次适应
+// first_fit.c把释放的块挂在链表头部，链表的顺序取决于释放的先后，
+// 找到的“第一个”块也就取决于释放的历史，而且要从头线性查找。
+// 这里空闲块按地址组织成一棵树堆(treap)，每个节点另外记下子树里最大的空闲块大小，
+// 于是“地址最低的、大小不小于size的块”可以从根往下O(log n)找到：
+// 左子树里有放得下的就往左，否则看当前块，再不行才往右。
+// 分配结果和从低地址开始线性查找的首次适应完全相同。
+// 树的节点放在空闲块的数据区里，树根保存在原来空闲链表表头的位置。
+
+// 树的节点，优先级在块第一次插入时由地址散列得到，
+// 之后块被拆分或者合并而换了地址时，新的块接替原来的位置，也沿用原来的优先级
+typedef struct
+{
+    Block* left;
+    Block* right;
+    BlockSize_t max;      // 子树里最大的空闲块大小
+    uint64_t priority;
+} TreeNode;
+
+#define TREE(pBlock) ((TreeNode*)(pBlock)->data)
+#define LEFT(pBlock) (TREE(pBlock)->left)
+#define RIGHT(pBlock) (TREE(pBlock)->right)
+#define MAX(pBlock) ((pBlock) ? TREE(pBlock)->max : 0)
+#define PRIORITY(pBlock) (TREE(pBlock)->priority)
+
+// 空闲块的数据区至少要放得下一个树节点
+#define TREE_BLOCK_MIN_SIZE (2 * sizeof(BlockSize_t) + sizeof(TreeNode))
+
+
+static uint64_t Hash(Block* p)
+{
+    return ((uint64_t)(uintptr_t)p >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+// 由孩子重新计算子树里最大的空闲块
+static void Update(Block* t)
+{
+    BlockSize_t max = t->size;
+    if(MAX(LEFT(t)) > max)
+        max = MAX(LEFT(t));
+    if(MAX(RIGHT(t)) > max)
+        max = MAX(RIGHT(t));
+    TREE(t)->max = max;
+}
+
+// 把子树t按地址拆成比curr低的l和比curr高的r
+static void Split(Block* t, Block* curr, Block** l, Block** r)
+{
+    if(t == NULL)
+    {
+        *l = *r = NULL;
+        return;
+    }
+    STAT(visited);
+    if(t < curr)
+    {
+        Split(RIGHT(t), curr, &RIGHT(t), r);
+        *l = t;
+    }
+    else
+    {
+        Split(LEFT(t), curr, l, &LEFT(t));
+        *r = t;
+    }
+    Update(t);
+}
+
+// 合并两棵子树，a里的块地址都比b里的低
+static Block* Merge(Block* a, Block* b)
+{
+    if(a == NULL)
+        return b;
+    if(b == NULL)
+        return a;
+    STAT(visited);
+    if(PRIORITY(a) >= PRIORITY(b))
+    {
+        RIGHT(a) = Merge(RIGHT(a), b);
+        Update(a);
+        return a;
+    }
+    LEFT(b) = Merge(a, LEFT(b));
+    Update(b);
+    return b;
+}
+
+// 把curr插入子树t，返回新的子树
+static Block* Insert(Block* t, Block* curr)
+{
+    if(t == NULL || PRIORITY(curr) > PRIORITY(t))
+    {
+        Split(t, curr, &LEFT(curr), &RIGHT(curr));
+        Update(curr);
+        return curr;
+    }
+    STAT(visited);
+    if(curr < t)
+        LEFT(t) = Insert(LEFT(t), curr);
+    else
+        RIGHT(t) = Insert(RIGHT(t), curr);
+    Update(t);
+    return t;
+}
+
+// 把curr从子树t中删除，返回新的子树
+static Block* Remove(Block* t, Block* curr)
+{
+    assert(t != NULL);
+    if(t == curr)
+        return Merge(LEFT(t), RIGHT(t));
+    STAT(visited);
+    if(curr < t)
+        LEFT(t) = Remove(LEFT(t), curr);
+    else
+        RIGHT(t) = Remove(RIGHT(t), curr);
+    Update(t);
+    return t;
+}
+
+// 让curr接替子树t里old的位置，沿途更新最大空闲块，返回新的子树
+// 两者之间不能有别的空闲块，这样按地址的顺序不变；curr和old可以是同一个块(只是大小变了)
+static Block* Replace(Block* t, Block* old, Block* curr)
+{
+    assert(t != NULL);
+    if(t == old)
+    {
+        if(curr != old)
+            *TREE(curr) = *TREE(old);
+        Update(curr);
+        return curr;
+    }
+    STAT(visited);
+    if(old < t)
+        LEFT(t) = Replace(LEFT(t), old, curr);
+    else
+        RIGHT(t) = Replace(RIGHT(t), old, curr);
+    Update(t);
+    return t;
+}
+
+static void InsertBlock(void* space, Block* curr)
+{
+    PRIORITY(curr) = Hash(curr);
+    Block** pRoot = GetPtrToHeadPtr(space);
+    *pRoot = Insert(*pRoot, curr);
+}
+
+static void RemoveBlock(void* space, Block* curr)
+{
+    Block** pRoot = GetPtrToHeadPtr(space);
+    *pRoot = Remove(*pRoot, curr);
+}
+
+static void ReplaceBlock(void* space, Block* old, Block* curr)
+{
+    Block** pRoot = GetPtrToHeadPtr(space);
+    *pRoot = Replace(*pRoot, old, curr);
+}
+
+// 找到地址最低的、放得下size的块，找不到时返回NULL
+static Block* FindFirstBlock(void* space, BlockSize_t size)
+{
+    Block* p = *GetPtrToHeadPtr(space);
+    if(MAX(p) < size)
+        return NULL;
+    while(1)
+    {
+        STAT(visited);
+        if(MAX(LEFT(p)) >= size)
+            p = LEFT(p);
+        else if(p->size >= size)
+            return p;
+        else
+            p = RIGHT(p);
+    }
+}
+
+
+// 初始化内存，整个内存作为一个空闲块，也是树根
+static void Initialize(void* space, BlockSize_t size)
+{
+    Block* pBlock = InitializeSpace(space, size, 0);
+    *GetPtrToHeadPtr(space) = NULL;
+    InsertBlock(space, pBlock);
+}
+
+
+static void* Malloc(void* space, BlockSize_t size)
+{
+    // 块被释放后要放得下树节点
+    if(size < (BlockSize_t)sizeof(TreeNode))
+        size = sizeof(TreeNode);
+    size = AlignSize(size);
+
+    Block* p = FindFirstBlock(space, size);
+    if(p == NULL)
+        return NULL;
+
+    // 拆分剩下的部分紧跟在p后面，直接接替p在树中的位置；不拆分时把p摘下
+    if(p->size >= size + (BlockSize_t)TREE_BLOCK_MIN_SIZE)
+        ReplaceBlock(space, p, SplitBlock(p, size));
+    else
+        RemoveBlock(space, p);
+
+    SetBlockUsed(p);
+    return (void*) p->data;
+}
+
+static void Free(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+
+    // 找到分配出去的这个块，并设置为未使用
+    Block* curr = SeekBlockFromData(ptr);
+    SetBlockUnused(curr);
+
+    // 合并不改变空闲块之间的地址顺序：
+    // 和前面的块合并时前面的块原地变大，和后面的块合并时由合并后的块接替它的位置
+    Block* prev = SeekPrevBlock(space, curr);
+    Block* next = SeekNextBlock(space, curr);
+    if(prev && next)
+    {
+        STAT(merges);
+        STAT(merges);
+        RemoveBlock(space, next);
+        prev->size += 4 * sizeof(BlockSize_t) + curr->size + next->size;
+        *SeekTailSize(prev) = prev->size;
+        ReplaceBlock(space, prev, prev);
+    }
+    else if(prev)
+    {
+        STAT(merges);
+        prev->size += 2 * sizeof(BlockSize_t) + curr->size;
+        *SeekTailSize(prev) = prev->size;
+        ReplaceBlock(space, prev, prev);
+    }
+    else if(next)
+    {
+        STAT(merges);
+        // next的节点落在合并后的块的数据区中间，不会被覆盖，ReplaceBlock会把它复制过来
+        curr->size += 2 * sizeof(BlockSize_t) + next->size;
+        *SeekTailSize(curr) = curr->size;
+        ReplaceBlock(space, next, curr);
+    }
+    else
+        InsertBlock(space, curr);
+}
+
+// 返回最大空闲块的大小
+static BlockSize_t Largest(void* space)
+{
+    return MAX(*GetPtrToHeadPtr(space));
+}
+
+
+// 按地址排序的首次适应算法的接口
+const Allocator AddrFit = { "addr", Initialize, Malloc, Free, Largest, RemoveBlock };
@@ -0,0 +1,325 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include "memana.h"
+#include "usage.h"
+#include "histogram.h"
+#include "slab.h"
+
+// Runs every strategy on a set of synthetic workloads generated in-process
+// from a fixed seed, and prints one tab-separated row per workload and
+// strategy:
+//   ops/s    Malloc+Free calls per second, the best of the repeated runs
+//   p50..max latency of a single call, from one more run that times calls
+//   peak_frag the highest external fragmentation seen, sampled every 1000 calls
+//   failed   Malloc calls that found no block
+// With -p, requests of up to SLAB_MAX_SIZE bytes are served from the slab
+// layer on top of each strategy, and the usage is that of the strategy's arena.
+//
+// usage: bench [-n ops] [-r repeats] [-s seed] [-p] [strategy...]
+
+#define SPACE_SIZE (64LL << 20)
+// the number of live blocks swings between LIVE_MAX / 2 and LIVE_MAX
+#define LIVE_MAX 4096
+#define SAMPLE_EVERY 1000
+// the phase-changing workload switches its sizes this often
+#define PHASE_LENGTH 20000
+
+typedef struct
+{
+    unsigned long long state;
+} Rng;
+
+// which live block a free releases
+typedef enum
+{
+    RANDOM,
+    LIFO,
+    FIFO,
+} Order;
+
+typedef struct
+{
+    const char* name;
+    BlockSize_t (*Size)(Rng* rng, long long op);
+    Order order;
+} Workload;
+
+typedef struct
+{
+    double opsPerSecond;
+    double peakFragmentation;
+    long long failed;
+} Result;
+
+// the live blocks, a ring buffer so both ends can be freed
+void* ring[LIVE_MAX];
+long long head, tail;
+
+Histogram ns;
+Usage usage;
+bool pooled;
+
+
+static unsigned long long Next(Rng* rng)
+{
+    // xorshift64*
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * 0x2545F4914F6CDD1DULL;
+}
+
+// uniform in [0, 1)
+static double Uniform(Rng* rng)
+{
+    return (Next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static BlockSize_t Between(Rng* rng, BlockSize_t low, BlockSize_t high)
+{
+    return low + (BlockSize_t)(Next(rng) % (unsigned long long)(high - low + 1));
+}
+
+static BlockSize_t Cap(double size)
+{
+    return size > (1 << 20) ? (1 << 20) : size < 1 ? 1 : (BlockSize_t) size;
+}
+
+
+static BlockSize_t UniformSize(Rng* rng, long long op)
+{
+    return Between(rng, 16, 4096);
+}
+
+// median e^6 = 403 bytes, long right tail
+static BlockSize_t LogNormalSize(Rng* rng, long long op)
+{
+    double u = 1 - Uniform(rng), v = Uniform(rng);
+    double normal = sqrt(-2 * log(u)) * cos(2 * 3.14159265358979323846 * v);
+    return Cap(exp(6 + 1.5 * normal));
+}
+
+// nine small objects for every large one
+static BlockSize_t BimodalSize(Rng* rng, long long op)
+{
+    if(Next(rng) % 10)
+        return Between(rng, 16, 128);
+    return Between(rng, 64 << 10, 256 << 10);
+}
+
+// Pareto with alpha 1.2 from 16 bytes
+static BlockSize_t PowerLawSize(Rng* rng, long long op)
+{
+    return Cap(16 * pow(1 - Uniform(rng), -1 / 1.2));
+}
+
+// small and large sizes take turns, so the free space has to be reshaped
+static BlockSize_t PhasedSize(Rng* rng, long long op)
+{
+    if(op / PHASE_LENGTH % 2 == 0)
+        return Between(rng, 16, 256);
+    return Between(rng, 4 << 10, 64 << 10);
+}
+
+const Workload workloads[] =
+{
+    { "uniform", UniformSize, RANDOM },
+    { "lognormal", LogNormalSize, RANDOM },
+    { "bimodal", BimodalSize, RANDOM },
+    { "powerlaw", PowerLawSize, RANDOM },
+    { "phased", PhasedSize, RANDOM },
+    { "lifo", LogNormalSize, LIFO },
+    { "fifo", LogNormalSize, FIFO },
+};
+
+
+static long long Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Takes a live block out of the ring, in the order of the workload.
+static void* Take(Rng* rng, Order order)
+{
+    long long live = tail - head;
+    if(order == FIFO)
+        return ring[head++ % LIVE_MAX];
+    if(order == RANDOM)
+    {
+        // swap the chosen block to the tail, then take it from there
+        long long k = head + (long long)(Next(rng) % live);
+        void* t = ring[k % LIVE_MAX];
+        ring[k % LIVE_MAX] = ring[(tail - 1) % LIVE_MAX];
+        ring[(tail - 1) % LIVE_MAX] = t;
+    }
+    return ring[--tail % LIVE_MAX];
+}
+
+static void* Malloc(const Allocator* a, void* space, BlockSize_t size)
+{
+    return pooled ? SlabMalloc(space, size) : a->Malloc(space, size);
+}
+
+static void Free(const Allocator* a, void* space, void* ptr)
+{
+    if(pooled)
+        SlabFree(space, ptr);
+    else
+        a->Free(space, ptr);
+}
+
+// One run of ops calls. With measure set, every call is timed and the
+// usage is tracked, which slows the run down, so ops/s comes from the
+// runs without it.
+static void Run(const Allocator* a, void* space, const Workload* w, unsigned long long seed,
+                long long ops, bool measure, Result* result)
+{
+    Rng rng = { seed };
+    // the strategy's own memory, under the slab layer when there is one
+    void* arena = space;
+    if(pooled)
+    {
+        InitializeSlabs(a, space, SPACE_SIZE);
+        arena = SlabArena(space);
+    }
+    else
+        a->Initialize(space, SPACE_SIZE);
+    if(measure)
+    {
+        InitializeUsage(&usage, a, arena);
+        if(pooled)
+            TrackSlabs(space, &usage);
+    }
+    head = tail = 0;
+    bool filling = true;
+
+    long long begin = Now();
+    for(long long op = 0; op < ops; op++)
+    {
+        long long live = tail - head;
+        if(live == LIVE_MAX)
+            filling = false;
+        else if(live <= LIVE_MAX / 2)
+            filling = true;
+
+        if(live == 0 || (filling && live < LIVE_MAX))
+        {
+            BlockSize_t size = w->Size(&rng, op);
+            long long t0 = measure ? Now() : 0;
+            void* ptr = Malloc(a, space, size);
+            if(measure)
+            {
+                Record(&ns, Now() - t0);
+                if(!pooled)
+                    TrackMalloc(&usage, space, ptr);
+            }
+            if(ptr == NULL)
+            {
+                result->failed++;
+                filling = false;
+            }
+            else
+                ring[tail++ % LIVE_MAX] = ptr;
+        }
+        else
+        {
+            void* ptr = Take(&rng, w->order);
+            long long t0 = measure ? Now() : 0;
+            if(measure && !pooled)
+                TrackFree(&usage, space, ptr);
+            Free(a, space, ptr);
+            if(measure)
+                Record(&ns, Now() - t0);
+        }
+
+        if(measure && op % SAMPLE_EVERY == 0)
+        {
+            RefreshUsage(&usage, arena);
+            double f = UsageFragmentation(&usage, a, arena);
+            if(f > result->peakFragmentation)
+                result->peakFragmentation = f;
+        }
+    }
+    long long end = Now();
+
+    while(tail > head)
+        Free(a, space, ring[--tail % LIVE_MAX]);
+    if(!measure)
+    {
+        double opsPerSecond = ops / ((end - begin) * 1e-9);
+        if(opsPerSecond > result->opsPerSecond)
+            result->opsPerSecond = opsPerSecond;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    long long ops = 200000;
+    int repeats = 3;
+    unsigned long long seed = 1;
+    int nAllocators = 0;
+    while(allocators[nAllocators])
+        nAllocators++;
+    const Allocator* selected[argc + nAllocators];
+    int nSelected = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            ops = atoll(argv[++i]);
+        else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            repeats = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-p") == 0)
+            pooled = true;
+        else if((selected[nSelected] = FindAllocator(argv[i])) != NULL)
+            nSelected++;
+        else
+        {
+            fprintf(stderr, "usage: %s [-n ops] [-r repeats] [-s seed] [-p] [strategy...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(ops < 1 || repeats < 1 || seed == 0)
+    {
+        fprintf(stderr, "ops and repeats must be positive, seed non-zero\n");
+        return 1;
+    }
+    if(nSelected == 0)
+        while(allocators[nSelected])
+            selected[nSelected] = allocators[nSelected], nSelected++;
+
+    void* space = malloc(SPACE_SIZE);
+    assert(space != NULL);
+
+    printf("workload\tstrategy\tops/s\tp50_ns\tp99_ns\tp99.9_ns\tmax_ns\tpeak_frag\tfailed\n");
+    for(size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+    {
+        for(int k = 0; k < nSelected; k++)
+        {
+            Result result = { 0 };
+            for(int r = 0; r < repeats; r++)
+                Run(selected[k], space, &workloads[w], seed, ops, false, &result);
+            memset(&ns, 0, sizeof(Histogram));
+            result.failed = 0;
+            Run(selected[k], space, &workloads[w], seed, ops, true, &result);
+
+            printf("%s\t%s\t%.0f\t%lld\t%lld\t%lld\t%lld\t%.4f\t%lld\n", workloads[w].name,
+                   selected[k]->name, result.opsPerSecond, Percentile(&ns, 50), Percentile(&ns, 99),
+                   Percentile(&ns, 99.9), ns.max, result.peakFragmentation, result.failed);
+            fflush(stdout);
+        }
+    }
+
+    free(space);
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include "memana.h"
+#include "concurrent.h"
+#include "sharded.h"
+
+// Multi-threaded throughput of one strategy, with a global mutex around
+// Malloc/Free ("locked"), through the per-thread caches ("cached") and
+// with one arena per thread ("sharded").
+// Every thread allocates and frees random small blocks; one in eight frees
+// hands the block over to another thread instead, which then frees it.
+//
+// usage: bench_mt [strategy] [max threads] [ops per thread]
+
+#define SPACE_SIZE (256LL << 20)
+#define SLOTS 1024
+#define EXCHANGE 4096
+
+typedef struct
+{
+    void* (*Malloc)(void* space, BlockSize_t size);
+    void (*Free)(void* space, void* ptr);
+} Mode;
+
+typedef struct
+{
+    const Mode* mode;
+    long long ops;
+    unsigned long long seed;
+} Worker;
+
+const Allocator* a;
+void* space;
+mtx_t lock;
+_Atomic(void*) exchange[EXCHANGE];
+
+
+static void* LockedMalloc(void* space, BlockSize_t size)
+{
+    mtx_lock(&lock);
+    void* ptr = a->Malloc(space, size);
+    mtx_unlock(&lock);
+    return ptr;
+}
+
+static void LockedFree(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+    mtx_lock(&lock);
+    a->Free(space, ptr);
+    mtx_unlock(&lock);
+}
+
+const Mode locked = { LockedMalloc, LockedFree };
+const Mode cached = { SharedMalloc, SharedFree };
+const Mode sharded = { ShardedMalloc, ShardedFree };
+
+
+static unsigned long long Random(unsigned long long* x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+static int Work(void* arg)
+{
+    Worker* w = (Worker*) arg;
+    const Mode* mode = w->mode;
+    void* slots[SLOTS] = { NULL };
+
+    for(long long k = 0; k < w->ops; k++)
+    {
+        unsigned long long r = Random(&w->seed);
+        int i = r % SLOTS;
+        if(slots[i] == NULL)
+        {
+            slots[i] = mode->Malloc(space, 16 + (r >> 16) % 512);
+            if(slots[i])
+                *(char*) slots[i] = 1;
+        }
+        else if((r >> 32) % 8 == 0)
+        {
+            void* other = atomic_exchange(&exchange[(r >> 40) % EXCHANGE], slots[i]);
+            mode->Free(space, other);
+            slots[i] = NULL;
+        }
+        else
+        {
+            mode->Free(space, slots[i]);
+            slots[i] = NULL;
+        }
+    }
+
+    for(int i = 0; i < SLOTS; i++)
+        mode->Free(space, slots[i]);
+    return 0;
+}
+
+static double Now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// returns million operations per second
+static double Run(const Mode* mode, int nThreads, long long ops)
+{
+    if(mode == &cached)
+        InitializeShared(a, space, SPACE_SIZE);
+    else if(mode == &sharded)
+        InitializeSharded(a, space, SPACE_SIZE, nThreads);
+    else
+        a->Initialize(space, SPACE_SIZE);
+    for(int i = 0; i < EXCHANGE; i++)
+        atomic_init(&exchange[i], NULL);
+
+    thrd_t threads[nThreads];
+    Worker workers[nThreads];
+    double begin = Now();
+    for(int i = 0; i < nThreads; i++)
+    {
+        workers[i] = (Worker){ mode, ops, 0x9E3779B97F4A7C15ULL * (i + 1) };
+        int ok = thrd_create(&threads[i], Work, &workers[i]);
+        assert(ok == thrd_success);
+        (void) ok;
+    }
+    for(int i = 0; i < nThreads; i++)
+        thrd_join(threads[i], NULL);
+    double end = Now();
+
+    for(int i = 0; i < EXCHANGE; i++)
+        mode->Free(space, atomic_load(&exchange[i]));
+    // the next run initializes the same space again
+    if(mode == &cached)
+        DestroyShared(space);
+    else if(mode == &sharded)
+        DestroySharded(space);
+    return nThreads * ops / (end - begin) / 1e6;
+}
+
+
+int main(int argc, char** argv)
+{
+    a = FindAllocator(argc > 1 ? argv[1] : "tlsf");
+    int maxThreads = argc > 2 ? atoi(argv[2]) : 4;
+    if(maxThreads > MAX_ARENAS)
+        maxThreads = MAX_ARENAS;
+    long long ops = argc > 3 ? atoll(argv[3]) : 1000000;
+    if(a == NULL || maxThreads < 1 || ops < 1)
+    {
+        fprintf(stderr, "usage: %s [strategy] [max threads] [ops per thread]\n", argv[0]);
+        return 1;
+    }
+
+    space = aligned_alloc(SHARED_ALIGNMENT, SPACE_SIZE);
+    assert(space != NULL);
+    mtx_init(&lock, mtx_plain);
+
+    printf("strategy: %s\n", a->name);
+    printf("threads\tlocked Mops/s\tcached Mops/s\tsharded Mops/s\n");
+    for(int n = 1; n <= maxThreads; n++)
+    {
+        double l = Run(&locked, n, ops);
+        double c = Run(&cached, n, ops);
+        double s = Run(&sharded, n, ops);
+        printf("%d\t%.2f\t%.2f\t%.2f\n", n, l, c, s);
+    }
+
+    mtx_destroy(&lock);
+    free(space);
+    return 0;
+}
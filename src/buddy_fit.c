@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "memana.h"
+
+#define dp(p) printf(#p " = %p\n", (p))
+#define dd(d) printf(#d " = %I64d\n", (d))
+#define ABS(size) ((size) >= 0 ? (size) : -(size))
+#define PREV(pBlock) ((pBlock)->node.prev)
+#define NEXT(pBlock) ((pBlock)->node.next)
+#define TAGS_SIZE (2 * (BlockSize_t)sizeof(BlockSize_t))
+
+// 伙伴系统：每个块连同首尾size一共占2^k字节，k称为块的阶，
+// 并且块相对第一个块的偏移是2^k的整数倍。
+// 一个k阶块的伙伴就是把偏移的第k位取反得到的那个k阶块，两者合起来正好是一个k+1阶块。
+// 分配时把找到的块对半拆分直到刚好放得下；释放时只要伙伴也空闲且没有被拆开，就合并成高一阶的块，
+// 所以拆分和合并都最多做O(log n)次，每次只需要一次异或找到伙伴。
+// 代价是请求的大小被向上取整到2的幂，平均浪费约1/4的空间(内部碎片)，
+// 而且相邻但不是伙伴的空闲块不会合并。
+//
+// 块仍然保留首尾size，size等于2^k减去首尾size，阶可以直接从size算出，
+// 这样按size遍历内存、从数据找到块这些公共操作都不受影响。
+// 每一阶是一条双向链表，另外用一个位图记录哪些阶不为空。
+#define ORDER_COUNT 64
+// 最小的块要在首尾size之间放得下链表节点
+#define MIN_ORDER 5
+// 第一个块的数据区按这个字节数对齐，k阶块的数据区相对它的偏移是2^k的整数倍，
+// 所以不超过它的对齐要求只要把块放大到相应的阶就能满足
+#define BUDDY_ALIGNMENT 4096
+
+// 保存在内存头部之后的各阶空闲链表
+typedef struct
+{
+    unsigned long long bitmap;
+    Block* lists[ORDER_COUNT];
+} Orders;
+
+
+static Orders* GetOrders(void* space)
+{
+    return (Orders*) GetExtraSpace(space);
+}
+
+// 大小为size的块的阶
+static int Order(BlockSize_t size)
+{
+    return __builtin_ctzll((unsigned long long)(size + TAGS_SIZE));
+}
+
+// 数据区放得下size字节的最小的阶
+static int OrderFor(BlockSize_t size)
+{
+    unsigned long long total = (unsigned long long)(size + TAGS_SIZE);
+    int k = 64 - __builtin_clzll(total - 1);
+    return k < MIN_ORDER ? MIN_ORDER : k;
+}
+
+// 把p设为一个空闲的k阶块，头尾size同步
+static void SetOrder(Block* p, int k)
+{
+    p->size = (1LL << k) - TAGS_SIZE;
+    *SeekTailSize(p) = p->size;
+}
+
+// 将空闲块挂到它所在阶的链表头部
+static void InsertBlock(void* space, Block* curr)
+{
+    Orders* orders = GetOrders(space);
+    int k = Order(curr->size);
+    Block* head = orders->lists[k];
+
+    PREV(curr) = NULL;
+    NEXT(curr) = head;
+    if(head)
+        PREV(head) = curr;
+    orders->lists[k] = curr;
+    orders->bitmap |= 1ULL << k;
+}
+
+// 将空闲块从它所在阶的链表中摘下，链表变空时清掉位图中对应的位
+static void RemoveBlock(void* space, Block* curr)
+{
+    Orders* orders = GetOrders(space);
+    int k = Order(curr->size);
+
+    if(PREV(curr))
+        NEXT(PREV(curr)) = NEXT(curr);
+    else
+        orders->lists[k] = NEXT(curr);
+    if(NEXT(curr))
+        PREV(NEXT(curr)) = PREV(curr);
+
+    if(orders->lists[k] == NULL)
+        orders->bitmap &= ~(1ULL << k);
+}
+
+// 找到p的伙伴，伙伴空闲且没有被拆开(阶和p相同)时返回它，否则返回NULL
+static Block* SeekBuddy(void* space, Block* p)
+{
+    char* base = (char*) SeekFirstBlock(space);
+    BlockSize_t total = p->size + TAGS_SIZE;
+    BlockSize_t offset = ((char*)p - base) ^ total;
+    // 内存大小不是2的幂时，末尾的块的伙伴可能超出内存
+    if(offset + total > GetSpaceSize(space))
+        return NULL;
+    Block* buddy = (Block*) Seek(base, offset);
+    if(buddy->size != p->size)
+        return NULL;
+    return buddy;
+}
+
+
+// 初始化内存，在内存头部之后保存各阶空闲链表，再留出让第一个块的数据区按BUDDY_ALIGNMENT对齐的空间
+// 内存按从大到小的2的幂切成若干块，每一块相对第一个块的偏移都是它大小的整数倍
+static void Initialize(void* space, BlockSize_t size)
+{
+    Orders* orders = GetOrders(space);
+    uintptr_t data = (uintptr_t) Seek(orders + 1, sizeof(BlockSize_t));
+    BlockSize_t pad = (BUDDY_ALIGNMENT - data % BUDDY_ALIGNMENT) % BUDDY_ALIGNMENT;
+    Block* p = InitializeSpace(space, size, sizeof(Orders) + pad);
+
+    orders->bitmap = 0;
+    for(int i = 0; i < ORDER_COUNT; i++)
+        orders->lists[i] = NULL;
+
+    BlockSize_t rest = GetSpaceSize(space);
+    for(int k = ORDER_COUNT - 2; k >= MIN_ORDER; k--)
+    {
+        if(rest < 1LL << k)
+            continue;
+        SetOrder(p, k);
+        InsertBlock(space, p);
+        p = (Block*) Seek(p, 1LL << k);
+        rest -= 1LL << k;
+    }
+    // 不足一个最小块的零头，在InitializeSpace之后的可用大小中扣掉
+    *(BlockSize_t*) Seek(space, sizeof(Block*)) -= rest;
+}
+
+
+static void* Malloc(void* space, BlockSize_t size)
+{
+    // 按对齐要求取整，块被释放后也要放得下链表节点
+    size = AlignSize(size);
+    int k = OrderFor(size);
+    if(k >= ORDER_COUNT - 1)
+        return NULL;
+
+    // 不小于k阶的最低的非空阶，取其中任意一块都可以
+    Orders* orders = GetOrders(space);
+    unsigned long long larger = orders->bitmap & (~0ULL << k);
+    if(larger == 0)
+        return NULL;
+    int i = __builtin_ctzll(larger);
+    Block* p = orders->lists[i];
+    RemoveBlock(space, p);
+
+    // 对半拆分，后一半挂回低一阶的链表，直到刚好是k阶
+    while(i > k)
+    {
+        STAT(splits);
+        i--;
+        Block* half = (Block*) Seek(p, 1LL << i);
+        SetOrder(half, i);
+        InsertBlock(space, half);
+    }
+    SetOrder(p, k);
+
+    SetBlockUsed(p);
+    return (void*) p->data;
+}
+
+static void Free(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+
+    // 找到分配出去的这个块，并设置为未使用
+    Block* curr = SeekBlockFromData(ptr);
+    SetBlockUnused(curr);
+
+    // 只要伙伴也空闲，就摘下伙伴合并成高一阶的块，合并后的块从两者中靠前的那个开始
+    Block* buddy;
+    while((buddy = SeekBuddy(space, curr)) != NULL)
+    {
+        STAT(merges);
+        RemoveBlock(space, buddy);
+        if(buddy < curr)
+            curr = buddy;
+        SetOrder(curr, Order(curr->size) + 1);
+    }
+    InsertBlock(space, curr);
+}
+
+// 按align对齐分配，把请求放大到整个块是align字节，块的阶就不低于log2(align)
+// 超过BUDDY_ALIGNMENT的对齐要求满足不了，返回NULL
+static void* AllocateAligned(void* space, BlockSize_t size, BlockSize_t align)
+{
+    if(align > BUDDY_ALIGNMENT)
+        return NULL;
+    if(size < align - TAGS_SIZE)
+        size = align - TAGS_SIZE;
+    return Malloc(space, size);
+}
+
+// 最大的空闲块就是最高的非空阶里的块
+static BlockSize_t Largest(void* space)
+{
+    unsigned long long bitmap = GetOrders(space)->bitmap;
+    if(bitmap == 0)
+        return 0;
+    return (1LL << (63 - __builtin_clzll(bitmap))) - TAGS_SIZE;
+}
+
+
+// 伙伴系统的接口
+// 释放时只和伙伴合并，相邻但不是伙伴的空闲块会一直分开
+const Allocator BuddyFit = { "buddy", Initialize, Malloc, Free, Largest, RemoveBlock, true, NULL, false, AllocateAligned };
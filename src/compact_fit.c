@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "memana.h"
+
+#define dp(p) printf(#p " = %p\n", (p))
+#define dd(d) printf(#d " = %I64d\n", (d))
+
+// 压缩块头的分组适应
+// 分组方式和seg_fit.c相同，区别只在块的格式：
+// 块的大小以ALIGNMENT字节为单位，和两个标志位一起放在4字节的块头里；
+// 已使用的块没有块尾，前一个块是否已使用记在后一个块的块头里，
+// 只有空闲块才在最后4字节写上大小，合并时由此找到前一个块的块头；
+// 空闲链表的指针换成相对第一个块的32位偏移(同样以ALIGNMENT字节为单位)。
+// 于是每个已使用的块只多占4字节，而标准格式要16字节；最小的块也只有ALIGNMENT字节。
+// 块头放在数据区之前的4字节，所以块从对齐位置之前4字节处开始，数据区仍然按ALIGNMENT对齐。
+// 一个块占size个单位时，数据区有size * ALIGNMENT - 4字节。
+//
+// 块的格式和标准的首尾size不同，只能通过Malloc/Free使用，由Walk遍历。
+// 内存里没有任何地址，整个space可以换一个地址继续使用，见persist.h。
+#define UNIT ALIGNMENT
+#define HEADER_SIZE ((BlockSize_t)sizeof(uint32_t))
+#define USED 1u
+#define PREV_USED 2u
+#define FLAG_BITS 2
+// 单位数和偏移都不超过这个数，可管理的内存最多16GB
+#define MAX_UNITS ((1u << (32 - FLAG_BITS)) - 1)
+// 空链表
+#define NIL UINT32_MAX
+#define BIN_COUNT 32
+
+// 保存在内存头部之后的分组信息
+typedef struct
+{
+    unsigned long long bitmap;
+    uint32_t bins[BIN_COUNT];
+    uint32_t units; // 块占的总单位数，之后是一个大小为0、始终已使用的哨兵块头
+} Control;
+
+// 空闲块数据区开头的链表节点
+typedef struct
+{
+    uint32_t next;
+    uint32_t prev;
+} Link;
+
+
+static Control* GetControl(void* space)
+{
+    return (Control*) GetExtraSpace(space);
+}
+
+// 偏移为0的块的块头
+static char* GetBase(void* space)
+{
+    return (char*) SeekFirstBlock(space) + sizeof(BlockSize_t) - HEADER_SIZE;
+}
+
+static uint32_t* Header(char* base, uint32_t b)
+{
+    return (uint32_t*)(base + (BlockSize_t)b * UNIT);
+}
+
+static uint32_t Units(char* base, uint32_t b)
+{
+    return *Header(base, b) >> FLAG_BITS;
+}
+
+static Link* GetLink(char* base, uint32_t b)
+{
+    return (Link*)(Header(base, b) + 1);
+}
+
+// 空闲块的块尾，也就是后一个块的块头之前的4字节
+static uint32_t* Footer(char* base, uint32_t b, uint32_t units)
+{
+    return Header(base, b + units) - 1;
+}
+
+static int BinIndex(uint32_t units)
+{
+    return 31 - __builtin_clz(units);
+}
+
+// 把b设为占units个单位的空闲块，写好块头和块尾，并告诉后一个块前一个块空闲
+// 空闲块总会和前面的空闲块合并，所以它前面的块一定已使用
+static void SetFree(char* base, uint32_t b, uint32_t units)
+{
+    *Header(base, b) = units << FLAG_BITS | PREV_USED;
+    *Footer(base, b, units) = units;
+    *Header(base, b + units) &= ~PREV_USED;
+}
+
+// 将空闲块挂到它所属组的链表头部
+static void InsertBlock(void* space, uint32_t b)
+{
+    Control* control = GetControl(space);
+    char* base = GetBase(space);
+    int i = BinIndex(Units(base, b));
+    uint32_t head = control->bins[i];
+
+    GetLink(base, b)->prev = NIL;
+    GetLink(base, b)->next = head;
+    if(head != NIL)
+        GetLink(base, head)->prev = b;
+    control->bins[i] = b;
+    control->bitmap |= 1ULL << i;
+}
+
+// 将空闲块从它所属组的链表中摘下，组变空时清掉位图中对应的位
+static void RemoveBlock(void* space, uint32_t b)
+{
+    Control* control = GetControl(space);
+    char* base = GetBase(space);
+    int i = BinIndex(Units(base, b));
+    Link* link = GetLink(base, b);
+
+    if(link->prev != NIL)
+        GetLink(base, link->prev)->next = link->next;
+    else
+        control->bins[i] = link->next;
+    if(link->next != NIL)
+        GetLink(base, link->next)->prev = link->prev;
+
+    if(control->bins[i] == NIL)
+        control->bitmap &= ~(1ULL << i);
+}
+
+// 找一个至少占units个单位的空闲块，找不到时返回NIL
+static uint32_t FindBlock(void* space, uint32_t units)
+{
+    Control* control = GetControl(space);
+    char* base = GetBase(space);
+    int i = BinIndex(units);
+
+    // 先看更大的组，取其中任意一块都可以
+    unsigned long long larger = i + 1 < BIN_COUNT ? control->bitmap & (~0ULL << (i + 1)) : 0;
+    if(larger)
+        return control->bins[__builtin_ctzll(larger)];
+
+    // 没有更大的组，只能在同一组里按首次适应查找
+    uint32_t b = control->bins[i];
+    while(b != NIL && Units(base, b) < units)
+    {
+        STAT(visited);
+        b = GetLink(base, b)->next;
+    }
+    return b;
+}
+
+
+// 初始化内存，在内存头部之后保存分组信息
+// 先按标准格式初始化内存头部，再把第一个块开始的内存重新按压缩的格式划分
+static void Initialize(void* space, BlockSize_t size)
+{
+    Control* control = GetControl(space);
+    InitializeSpace(space, size, sizeof(Control));
+    *GetPtrToHeadPtr(space) = NULL;
+
+    // 末尾要留出哨兵块头
+    BlockSize_t units = (GetSpaceSize(space) - (sizeof(BlockSize_t) - HEADER_SIZE) - HEADER_SIZE) / UNIT;
+    assert(units > 0 && units <= MAX_UNITS);
+    control->units = (uint32_t) units;
+    control->bitmap = 0;
+    for(int i = 0; i < BIN_COUNT; i++)
+        control->bins[i] = NIL;
+
+    char* base = GetBase(space);
+    *Header(base, control->units) = USED;
+    SetFree(base, 0, control->units);
+    InsertBlock(space, 0);
+}
+
+
+static void* Malloc(void* space, BlockSize_t size)
+{
+    Control* control = GetControl(space);
+    char* base = GetBase(space);
+
+    // 块头之后是数据区，一起向上取整到整数个单位
+    if(size < 0 || size > (BlockSize_t) control->units * UNIT)
+        return NULL;
+    uint32_t units = (uint32_t)((size + HEADER_SIZE + UNIT - 1) / UNIT);
+    if(units == 0)
+        units = 1;
+
+    uint32_t b = FindBlock(space, units);
+    if(b == NIL)
+        return NULL;
+
+    // 把块从组中摘下，多余的部分拆成一个新的空闲块挂回对应的组
+    RemoveBlock(space, b);
+    uint32_t total = Units(base, b);
+    if(total > units)
+    {
+        STAT(splits);
+        SetFree(base, b + units, total - units);
+        InsertBlock(space, b + units);
+    }
+    else
+    {
+        units = total;
+        *Header(base, b + units) |= PREV_USED;
+    }
+
+    *Header(base, b) = units << FLAG_BITS | (*Header(base, b) & PREV_USED) | USED;
+    return (void*)(Header(base, b) + 1);
+}
+
+static void Free(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+
+    char* base = GetBase(space);
+    uint32_t b = (uint32_t)(((char*)ptr - HEADER_SIZE - base) / UNIT);
+    uint32_t header = *Header(base, b);
+    assert(header & USED);
+    uint32_t units = header >> FLAG_BITS;
+
+    // 前一个块空闲时，由它的块尾找到它，摘下后合并
+    if(!(header & PREV_USED))
+    {
+        STAT(merges);
+        uint32_t prevUnits = *(Header(base, b) - 1);
+        b -= prevUnits;
+        units += prevUnits;
+        RemoveBlock(space, b);
+    }
+    // 后一个块空闲时同样摘下合并，哨兵始终是已使用的
+    uint32_t next = b + units;
+    if(!(*Header(base, next) & USED))
+    {
+        STAT(merges);
+        RemoveBlock(space, next);
+        units += Units(base, next);
+    }
+
+    SetFree(base, b, units);
+    InsertBlock(space, b);
+}
+
+// 把已使用的块b在第units个单位处切开，后一半也作为已使用的块，返回它的偏移
+static uint32_t CutUsed(char* base, uint32_t b, uint32_t units)
+{
+    uint32_t total = Units(base, b);
+    assert(units > 0 && units < total);
+    *Header(base, b) = units << FLAG_BITS | (*Header(base, b) & PREV_USED) | USED;
+    *Header(base, b + units) = (total - units) << FLAG_BITS | PREV_USED | USED;
+    return b + units;
+}
+
+// 按align对齐分配：多分配align - UNIT字节，数据区总能在其中找到对齐的位置，
+// 切下前后多余的部分释放掉，由Free和两边的空闲块合并
+static void* AllocateAligned(void* space, BlockSize_t size, BlockSize_t align)
+{
+    char* ptr = (char*) Malloc(space, size + align - UNIT);
+    if(ptr == NULL)
+        return NULL;
+
+    char* base = GetBase(space);
+    uint32_t b = (uint32_t)((ptr - HEADER_SIZE - base) / UNIT);
+    uint32_t front = (uint32_t)((align - (uintptr_t) ptr % align) % align / UNIT);
+    if(front > 0)
+    {
+        uint32_t aligned = CutUsed(base, b, front);
+        Free(space, Header(base, b) + 1);
+        b = aligned;
+    }
+
+    uint32_t units = (uint32_t)((size + HEADER_SIZE + UNIT - 1) / UNIT);
+    if(units == 0)
+        units = 1;
+    if(Units(base, b) > units)
+        Free(space, Header(base, CutUsed(base, b, units)) + 1);
+    return (void*)(Header(base, b) + 1);
+}
+
+// 分配出去的ptr能用的字节数
+static BlockSize_t DataSize(void* space, void* ptr)
+{
+    char* base = GetBase(space);
+    uint32_t b = (uint32_t)(((char*)ptr - HEADER_SIZE - base) / UNIT);
+    return (BlockSize_t) Units(base, b) * UNIT - HEADER_SIZE;
+}
+
+// 按地址顺序访问每个块，数据区的大小都按分配出去时能用的字节数算
+static void Walk(void* space, void (*visit)(void* ctx, void* data, BlockSize_t size, bool used), void* ctx)
+{
+    Control* control = GetControl(space);
+    char* base = GetBase(space);
+    for(uint32_t b = 0; b < control->units; b += Units(base, b))
+        visit(ctx, Header(base, b) + 1, (BlockSize_t) Units(base, b) * UNIT - HEADER_SIZE, *Header(base, b) & USED);
+}
+
+
+// 压缩块头的分组适应算法的接口
+const Allocator CompactFit = { "compact", Initialize, Malloc, Free, NULL, NULL, false, Walk, true, AllocateAligned, DataSize };
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include "concurrent.h"
+
+// 不超过SMALL_MAX的请求由线程缓存处理，按ALIGNMENT分成CACHE_CLASSES组
+#define CACHE_CLASSES 64
+#define SMALL_MAX (CACHE_CLASSES * ALIGNMENT)
+// 每组最多缓存的块数，超过后还回去一半
+#define CACHE_LIMIT 64
+// 每次从共享内存补充的块数
+#define BATCH 16
+// 最多同时使用缓存的线程数，再多的线程直接加锁分配
+#define MAX_THREADS 64
+
+// 缓存槽的状态
+#define SLOT_FREE 0
+#define SLOT_USED 1
+#define SLOT_ORPHAN 2 // 线程已退出，但别的线程可能还在往它的队列里还块
+
+// 缓存中的块，链接指针直接放在分配出去的内存里
+typedef struct Object_
+{
+    struct Object_* next;
+} Object;
+
+typedef struct Cache_ Cache;
+
+// 每次分配都在用户内存前面放一个前缀，记录是哪个线程缓存分配的
+// 大小正好是ALIGNMENT，不会破坏对齐
+typedef struct
+{
+    Cache* owner; // 直接从共享内存分配的大块为NULL
+    BlockSize_t cls;
+} Prefix;
+
+// 一个线程的缓存
+// 只有所有者使用的部分和别的线程会修改的remote各占自己的缓存行，
+// 相邻的缓存之间、所有者和释放方之间都不会共用缓存行
+struct Cache_
+{
+    _Alignas(SHARED_ALIGNMENT) Object* lists[CACHE_CLASSES];
+    int counts[CACHE_CLASSES];
+    void* space;
+    // 别的线程释放的块，无锁的栈：释放方压入，所有者一次取走整个栈
+    _Alignas(SHARED_ALIGNMENT) _Atomic(Object*) remote;
+    atomic_int state;
+};
+
+// 放在space开头的共享信息，后面才是真正交给算法管理的内存
+typedef struct
+{
+    const Allocator* a;
+    mtx_t lock;
+    unsigned long long generation; // 每次InitializeShared都不同
+    Cache caches[MAX_THREADS];
+} Shared;
+
+// 所有共享内存的初始化次数，用来给每次初始化一个不同的generation
+static atomic_ullong generations;
+
+// 当前线程正在使用的缓存，和取得它时共享内存的generation
+// 同一块space重新初始化之后generation变了，原来的缓存就不再属于这个线程
+static _Thread_local Cache* localCache;
+static _Thread_local unsigned long long localGeneration;
+
+// 线程退出时通过这个key的析构函数归还缓存
+static tss_t exitKey;
+static once_flag exitOnce = ONCE_FLAG_INIT;
+
+
+static Shared* GetShared(void* space)
+{
+    return (Shared*) space;
+}
+
+// 返回交给算法管理的内存
+static void* GetInner(void* space)
+{
+    return Seek(space, (sizeof(Shared) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+}
+
+static Prefix* GetPrefix(void* ptr)
+{
+    return (Prefix*) Seek(ptr, -(BlockSize_t)sizeof(Prefix));
+}
+
+// 把块放回所在组，不检查上限
+static void PushLocal(Cache* cache, Object* o)
+{
+    BlockSize_t c = GetPrefix(o)->cls;
+    o->next = cache->lists[c];
+    cache->lists[c] = o;
+    cache->counts[c]++;
+}
+
+// 加锁时把块还给算法
+static void ReleaseObject(Shared* shared, void* space, Object* o)
+{
+    shared->a->Free(GetInner(space), GetPrefix(o));
+}
+
+// 取走别的线程还回来的块，放进各自的组
+static void DrainRemote(Cache* cache)
+{
+    Object* o = atomic_exchange_explicit(&cache->remote, NULL, memory_order_acquire);
+    while(o)
+    {
+        Object* next = o->next;
+        PushLocal(cache, o);
+        o = next;
+    }
+}
+
+// 把缓存里的块全部还给共享内存
+static void FlushCache(Cache* cache)
+{
+    Shared* shared = GetShared(cache->space);
+    DrainRemote(cache);
+
+    mtx_lock(&shared->lock);
+    for(int c = 0; c < CACHE_CLASSES; c++)
+    {
+        while(cache->lists[c])
+        {
+            Object* o = cache->lists[c];
+            cache->lists[c] = o->next;
+            ReleaseObject(shared, cache->space, o);
+        }
+        cache->counts[c] = 0;
+    }
+    mtx_unlock(&shared->lock);
+}
+
+// 线程的缓存是否还属于space现在的这次初始化
+static bool IsCurrent(Cache* cache)
+{
+    return localGeneration == GetShared(cache->space)->generation;
+}
+
+// 线程不再使用这个缓存，别的线程还在路上的块留在队列里，
+// 等这个槽被下一个线程接手时再处理
+// space重新初始化过的话，这个槽已经被清空，可能又给了别的线程，什么都不做
+static void ReleaseCache(void* cache)
+{
+    if(!IsCurrent((Cache*) cache))
+        return;
+    FlushCache((Cache*) cache);
+    atomic_store(&((Cache*) cache)->state, SLOT_ORPHAN);
+}
+
+static void CreateExitKey(void)
+{
+    int ok = tss_create(&exitKey, ReleaseCache);
+    assert(ok == thrd_success);
+    (void) ok;
+}
+
+// 返回当前线程在space上的缓存，没有空闲的槽时返回NULL
+static Cache* GetCache(void* space)
+{
+    if(localCache && localCache->space == space && IsCurrent(localCache))
+        return localCache;
+
+    // 每个线程只保留一个缓存，换了一块共享内存就把原来的缓存还回去
+    call_once(&exitOnce, CreateExitKey);
+    if(localCache)
+    {
+        ReleaseCache(localCache);
+        localCache = NULL;
+        tss_set(exitKey, NULL);
+    }
+
+    Shared* shared = GetShared(space);
+    for(int i = 0; i < MAX_THREADS; i++)
+    {
+        Cache* cache = &shared->caches[i];
+        int expected = SLOT_FREE;
+        if(!atomic_compare_exchange_strong(&cache->state, &expected, SLOT_USED))
+        {
+            expected = SLOT_ORPHAN;
+            if(!atomic_compare_exchange_strong(&cache->state, &expected, SLOT_USED))
+                continue;
+            // 接手已退出线程的槽，先把它队列里剩下的块还回去
+            FlushCache(cache);
+        }
+        localCache = cache;
+        localGeneration = shared->generation;
+        tss_set(exitKey, cache);
+        return cache;
+    }
+    return NULL;
+}
+
+// 加锁从共享内存分配，owner为NULL表示不经过缓存
+static void* SharedMallocLocked(Shared* shared, void* space, BlockSize_t size, Cache* owner, BlockSize_t cls)
+{
+    mtx_lock(&shared->lock);
+    Prefix* prefix = (Prefix*) shared->a->Malloc(GetInner(space), size + sizeof(Prefix));
+    mtx_unlock(&shared->lock);
+    if(prefix == NULL)
+        return NULL;
+    prefix->owner = owner;
+    prefix->cls = cls;
+    return (void*) (prefix + 1);
+}
+
+// 一次加锁，为第c组补充最多BATCH个块
+static void Refill(Shared* shared, void* space, Cache* cache, int c)
+{
+    BlockSize_t size = (c + 1) * ALIGNMENT + sizeof(Prefix);
+    mtx_lock(&shared->lock);
+    for(int k = 0; k < BATCH; k++)
+    {
+        Prefix* prefix = (Prefix*) shared->a->Malloc(GetInner(space), size);
+        if(prefix == NULL)
+            break;
+        prefix->owner = cache;
+        prefix->cls = c;
+        PushLocal(cache, (Object*) (prefix + 1));
+    }
+    mtx_unlock(&shared->lock);
+}
+
+// 一次加锁，把第c组多出来的一半还给共享内存
+static void Trim(Shared* shared, Cache* cache, int c)
+{
+    mtx_lock(&shared->lock);
+    while(cache->counts[c] > CACHE_LIMIT / 2)
+    {
+        Object* o = cache->lists[c];
+        cache->lists[c] = o->next;
+        cache->counts[c]--;
+        ReleaseObject(shared, cache->space, o);
+    }
+    mtx_unlock(&shared->lock);
+}
+
+
+void InitializeShared(const Allocator* a, void* space, BlockSize_t size)
+{
+    Shared* shared = GetShared(space);
+    void* inner = GetInner(space);
+    assert((uintptr_t) space % SHARED_ALIGNMENT == 0);
+    assert(size > (char*)inner - (char*)space);
+
+    shared->a = a;
+    shared->generation = atomic_fetch_add(&generations, 1) + 1;
+    int ok = mtx_init(&shared->lock, mtx_plain);
+    assert(ok == thrd_success);
+    (void) ok;
+    for(int i = 0; i < MAX_THREADS; i++)
+    {
+        Cache* cache = &shared->caches[i];
+        for(int c = 0; c < CACHE_CLASSES; c++)
+        {
+            cache->lists[c] = NULL;
+            cache->counts[c] = 0;
+        }
+        atomic_init(&cache->remote, NULL);
+        atomic_init(&cache->state, SLOT_FREE);
+        cache->space = space;
+    }
+
+    a->Initialize(inner, size - ((char*)inner - (char*)space));
+}
+
+void DestroyShared(void* space)
+{
+    mtx_destroy(&GetShared(space)->lock);
+}
+
+void* SharedMalloc(void* space, BlockSize_t size)
+{
+    Shared* shared = GetShared(space);
+    size = AlignSize(size);
+
+    Cache* cache = size <= SMALL_MAX ? GetCache(space) : NULL;
+    if(cache == NULL)
+        return SharedMallocLocked(shared, space, size, NULL, 0);
+
+    // 本组为空时，先看看别的线程有没有还回来的块，再从共享内存补充
+    int c = (int)(size / ALIGNMENT) - 1;
+    if(cache->lists[c] == NULL)
+        DrainRemote(cache);
+    if(cache->lists[c] == NULL)
+        Refill(shared, space, cache, c);
+    if(cache->lists[c] == NULL)
+        return NULL;
+
+    Object* o = cache->lists[c];
+    cache->lists[c] = o->next;
+    cache->counts[c]--;
+    return (void*) o;
+}
+
+void SharedFree(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+
+    Shared* shared = GetShared(space);
+    Prefix* prefix = GetPrefix(ptr);
+    Cache* owner = prefix->owner;
+
+    // 不经过缓存分配的块直接还给共享内存
+    if(owner == NULL)
+    {
+        mtx_lock(&shared->lock);
+        shared->a->Free(GetInner(space), prefix);
+        mtx_unlock(&shared->lock);
+        return;
+    }
+
+    // 自己分配的块放回自己的缓存
+    Object* o = (Object*) ptr;
+    if(owner == localCache && IsCurrent(owner))
+    {
+        PushLocal(owner, o);
+        if(owner->counts[prefix->cls] > CACHE_LIMIT)
+            Trim(shared, owner, (int) prefix->cls);
+        return;
+    }
+
+    // 别的线程分配的块压入它的无锁队列
+    Object* head = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+    do
+    {
+        o->next = head;
+    } while(!atomic_compare_exchange_weak_explicit(&owner->remote, &head, o,
+                memory_order_release, memory_order_relaxed));
+}
+
+void FlushThreadCache(void* space)
+{
+    if(localCache && localCache->space == space && IsCurrent(localCache))
+        FlushCache(localCache);
+}
@@ -1,3 +1,4 @@
+import os
 from random import *
 
 T = 1000
@@ -17,5 +18,5 @@ for i in range(T + 1):
 
 data = '%d %d\n' % (n, M) + data
 
-with open('data\\input.txt', 'w') as f:
+with open(os.path.join('data', 'input.txt'), 'w') as f:
     f.write(data)
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include "deferred.h"
+
+#define ABS(size) ((size) >= 0 ? (size) : -(size))
+#define TAGS_SIZE (2 * sizeof(BlockSize_t))
+
+// 快速链表按大小散列，一个链表里可能有几种大小
+#define QUICK_LISTS 64
+// 快速链表里的块数超过这个数就全部还回去
+#define QUICK_LIMIT 64
+// 快速链表里的字节数超过内存的这个比例也全部还回去，免得大块闲置太久
+#define QUICK_BYTES_SHIFT 4
+
+// 快速链表里的块的数据区开头
+// 算法可能把块分得比请求的大(最小块、2的幂、剩下的太少而不拆分)，
+// 所以记下释放时给出的请求大小，按它查找
+typedef struct
+{
+    Block* next;
+    BlockSize_t aligned; // AlignSize之后的请求大小
+} QuickNode;
+
+#define QUICK(pBlock) ((QuickNode*)(pBlock)->data)
+
+// 放在space开头的信息，后面才是真正交给算法管理的内存
+typedef struct
+{
+    const Allocator* a;
+    Block* lists[QUICK_LISTS];
+    DeferredStats stats;
+    BlockSize_t maxBytes;
+    Usage* usage;
+} Deferred;
+
+
+static Deferred* GetDeferred(void* space)
+{
+    return (Deferred*) space;
+}
+
+static int ListIndex(BlockSize_t size)
+{
+    return (int)(size / ALIGNMENT % QUICK_LISTS);
+}
+
+// 调用算法分配，需要时记录使用情况
+static void* InnerMalloc(Deferred* deferred, void* arena, BlockSize_t size)
+{
+    void* ptr = deferred->a->Malloc(arena, size);
+    if(deferred->usage)
+        TrackMalloc(deferred->usage, arena, ptr);
+    return ptr;
+}
+
+static void InnerFree(Deferred* deferred, void* arena, void* ptr)
+{
+    if(deferred->usage)
+        TrackFree(deferred->usage, arena, ptr);
+    deferred->a->Free(arena, ptr);
+}
+
+static int CompareAddress(const void* x, const void* y)
+{
+    uintptr_t p = (uintptr_t) *(Block* const*)x;
+    uintptr_t q = (uintptr_t) *(Block* const*)y;
+    return (p > q) - (p < q);
+}
+
+// 把快速链表里的块全部还给算法之后，新合并出来的空闲块最多有多大
+// 每个块和两边的空闲块连成一段，按地址排序后首尾相接的段再连起来，
+// 算法释放时立即合并，每一段就是合并出来的一个空闲块
+static BlockSize_t FlushLargest(Deferred* deferred, void* arena)
+{
+    Block* blocks[QUICK_LIMIT];
+    int n = 0;
+    for(int i = 0; i < QUICK_LISTS; i++)
+        for(Block* p = deferred->lists[i]; p; p = QUICK(p)->next)
+            blocks[n++] = p;
+    qsort(blocks, n, sizeof(Block*), CompareAddress);
+
+    BlockSize_t largest = 0;
+    char* begin = NULL;
+    char* end = NULL;
+    for(int i = 0; i < n; i++)
+    {
+        Block* prev = SeekPrevBlock(arena, blocks[i]);
+        Block* next = SeekNextBlock(arena, blocks[i]);
+        char* lo = (char*)(prev ? prev : blocks[i]);
+        Block* last = next ? next : blocks[i];
+        char* hi = (char*) Seek(last, ABS(last->size) + TAGS_SIZE);
+        // 和前一段重叠(共用中间的空闲块)或者首尾相接时连起来
+        if(begin == NULL || lo > end)
+            begin = lo;
+        end = hi;
+        if(end - begin - (BlockSize_t)TAGS_SIZE > largest)
+            largest = end - begin - TAGS_SIZE;
+    }
+    return largest;
+}
+
+
+void* DeferredArena(void* space)
+{
+    return Seek(space, (sizeof(Deferred) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+}
+
+void InitializeDeferred(const Allocator* a, void* space, BlockSize_t size)
+{
+    assert(!a->lazyMerge && a->Walk == NULL);
+    Deferred* deferred = GetDeferred(space);
+    void* arena = DeferredArena(space);
+    assert(size > (char*)arena - (char*)space);
+
+    deferred->a = a;
+    for(int i = 0; i < QUICK_LISTS; i++)
+        deferred->lists[i] = NULL;
+    deferred->stats = (DeferredStats){ 0 };
+    deferred->usage = NULL;
+
+    size -= (char*)arena - (char*)space;
+    deferred->maxBytes = size >> QUICK_BYTES_SHIFT;
+    a->Initialize(arena, size);
+}
+
+void* DeferredMalloc(void* space, BlockSize_t size)
+{
+    Deferred* deferred = GetDeferred(space);
+    void* arena = DeferredArena(space);
+
+    // 先在快速链表里找请求大小相同的块
+    BlockSize_t aligned = AlignSize(size);
+    Block** link = &deferred->lists[ListIndex(aligned)];
+    for(; *link; link = &QUICK(*link)->next)
+    {
+        Block* p = *link;
+        if(QUICK(p)->aligned == aligned)
+        {
+            assert(ABS(p->size) >= aligned);
+            *link = QUICK(p)->next;
+            deferred->stats.hits++;
+            deferred->stats.blocks--;
+            deferred->stats.bytes -= ABS(p->size);
+            return (void*) p->data;
+        }
+    }
+
+    // 最大空闲块放不下就不用找了
+    const Allocator* a = deferred->a;
+    void* ptr = NULL;
+    if(a->Largest == NULL || a->Largest(arena) >= aligned)
+        ptr = InnerMalloc(deferred, arena, size);
+    // 合并延迟的块有可能放得下时，全部还回去再试一次
+    if(ptr == NULL && deferred->stats.blocks > 0 && FlushLargest(deferred, arena) >= aligned)
+    {
+        FlushDeferred(space);
+        ptr = InnerMalloc(deferred, arena, size);
+    }
+    return ptr;
+}
+
+void DeferredFree(void* space, void* ptr, BlockSize_t size)
+{
+    if(ptr == NULL)
+        return;
+
+    // 块保持已使用的状态，相邻的块释放时就不会和它合并
+    Deferred* deferred = GetDeferred(space);
+    Block* p = SeekBlockFromData(ptr);
+    BlockSize_t aligned = AlignSize(size);
+    assert(ABS(p->size) >= aligned);
+    Block** list = &deferred->lists[ListIndex(aligned)];
+    QUICK(p)->next = *list;
+    QUICK(p)->aligned = aligned;
+    *list = p;
+    deferred->stats.blocks++;
+    deferred->stats.bytes += ABS(p->size);
+
+    if(deferred->stats.blocks > QUICK_LIMIT || deferred->stats.bytes > deferred->maxBytes)
+        FlushDeferred(space);
+}
+
+void FlushDeferred(void* space)
+{
+    Deferred* deferred = GetDeferred(space);
+    void* arena = DeferredArena(space);
+    if(deferred->stats.blocks == 0)
+        return;
+
+    for(int i = 0; i < QUICK_LISTS; i++)
+    {
+        Block* p = deferred->lists[i];
+        deferred->lists[i] = NULL;
+        while(p)
+        {
+            Block* next = QUICK(p)->next;
+            InnerFree(deferred, arena, p->data);
+            p = next;
+        }
+    }
+    deferred->stats.blocks = 0;
+    deferred->stats.bytes = 0;
+    deferred->stats.flushes++;
+}
+
+void TrackDeferred(void* space, Usage* u)
+{
+    GetDeferred(space)->usage = u;
+}
+
+DeferredStats GetDeferredStats(void* space)
+{
+    return GetDeferred(space)->stats;
+}
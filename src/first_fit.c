@@ -12,41 +12,28 @@
 
 
 // 初始化内存，在内存头部写入可用内存大小和空闲链表表头地址
-void Initialize(void* space, BlockSize_t size)
+static void Initialize(void* space, BlockSize_t size)
 {
-    assert(size >= sizeof(Block*) + 2 * sizeof(BlockSize_t) + sizeof(Block));
-
-    // 写入可用内存大小（去掉开头的两个元数据后所剩大小)
-    BlockSize_t* pSpaceSize = (BlockSize_t*) Seek(space, sizeof(Block*));
-    *pSpaceSize = size - sizeof(Block*) - sizeof(BlockSize_t);
-
-    // 写入第一个Block的地址，作为空闲链表表头
-    Block** pHeadPtr = GetPtrToHeadPtr(space);
-    *pHeadPtr = (Block*) Seek(space, sizeof(Block*) + sizeof(BlockSize_t));
-
-    // 初始化第一个Block
-    Block* pBlock = *pHeadPtr;
+    // 整个内存作为一个空闲块，也是空闲链表的表头
+    Block* pBlock = InitializeSpace(space, size, 0);
     PREV(pBlock) = NULL;
     NEXT(pBlock) = NULL;
-
-    // 这个Block的可用大小要扣掉头尾两个存放size的空间
-    BlockSize_t* pHeadSize = SeekHeadSize(pBlock);
-    *pHeadSize = *pSpaceSize - 2 * sizeof(BlockSize_t);
-
-    // 设置尾部的size，头尾size始终要相同
-    BlockSize_t* pTailSize = SeekTailSize(pBlock);
-    *pTailSize = *pHeadSize;
-
 }
 
 
-void* Malloc(void* space, BlockSize_t size)
+static void* Malloc(void* space, BlockSize_t size)
 {
+    // 按对齐要求取整，这样拆分出来的块也都是对齐的
+    size = AlignSize(size);
+
     // 查找第一个空间足够的空闲块
     Block* head = *GetPtrToHeadPtr(space);
     Block* p = head;
     while(p && p->size < size)
+    {
+        STAT(visited);
         p = NEXT(p);
+    }
     if(p == NULL)
         return NULL;
 
@@ -56,7 +43,7 @@ void* Malloc(void* space, BlockSize_t size)
     Block *prev = PREV(p), *next = NEXT(p);
     if(p->size >= size + BLOCK_MIN_SIZE)
     {
-
+        STAT(splits);
         BlockSize_t* pHeadSize = SeekHeadSize(p);
         BlockSize_t* pTailSize = SeekTailSize(p);
         assert(*pHeadSize == *pTailSize);
@@ -104,7 +91,7 @@ void* Malloc(void* space, BlockSize_t size)
     return (void*) p->data;
 }
 
-void Free(void* space, void* ptr)
+static void Free(void* space, void* ptr)
 {
     if(ptr == NULL)
         return;
@@ -138,6 +125,5 @@ void Free(void* space, void* ptr)
 }
 
 
-
-
-
+// 首次适应算法的接口
+const Allocator FirstFit = { "first", Initialize, Malloc, Free, NULL, TakeOffBlock };
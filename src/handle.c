@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "handle.h"
+
+#define ABS(size) ((size) >= 0 ? (size) : -(size))
+#define TAGS_SIZE (2 * sizeof(BlockSize_t))
+
+// 句柄表的一项
+// 正在使用时ptr是内存的地址；空闲时ptr为NULL，pins是下一个空闲项的下标
+typedef struct
+{
+    void* ptr;
+    BlockSize_t pins;
+} Entry;
+
+// 放在每块内存前面，记下它属于哪个句柄，整理时由块找到句柄
+// 大小正好是ALIGNMENT，不会破坏对齐
+typedef struct
+{
+    Handle handle;
+    BlockSize_t unused;
+} Prefix;
+
+// 放在space开头的信息，后面是句柄表，再后面才是交给算法管理的内存
+typedef struct
+{
+    const Allocator* a;
+    BlockSize_t capacity;
+    BlockSize_t freeEntry; // 第一个空闲项，-1表示没有
+    BlockSize_t usedBytes; // 已分配块的大小之和，包括首尾size
+    Usage* usage;
+} Handles;
+
+
+static Handles* GetHandles(void* space)
+{
+    return (Handles*) space;
+}
+
+// 句柄h对应第h - 1项，这样0可以表示分配失败
+static Entry* GetEntry(void* space, Handle h)
+{
+    Handles* handles = GetHandles(space);
+    assert(h > 0 && h <= handles->capacity);
+    return (Entry*) Seek(space, sizeof(Handles)) + (h - 1);
+}
+
+static Prefix* GetPrefix(void* ptr)
+{
+    return (Prefix*) Seek(ptr, -(BlockSize_t)sizeof(Prefix));
+}
+
+// 把[begin, end)变成一个空闲块交给算法，两边都是已使用的块，所以不会合并
+static void ReleaseGap(Handles* handles, void* arena, char* begin, char* end)
+{
+    if(begin == end)
+        return;
+    Block* gap = (Block*) begin;
+    gap->size = -(end - begin - (BlockSize_t)TAGS_SIZE);
+    *SeekTailSize(gap) = gap->size;
+    handles->a->Free(arena, gap->data);
+}
+
+
+void* HandleArena(void* space)
+{
+    BlockSize_t capacity = GetHandles(space)->capacity;
+    BlockSize_t header = sizeof(Handles) + capacity * sizeof(Entry);
+    return Seek(space, (header + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+}
+
+void InitializeHandles(const Allocator* a, void* space, BlockSize_t size, BlockSize_t maxHandles)
+{
+    assert(!a->lazyMerge && a->Walk == NULL);
+    Handles* handles = GetHandles(space);
+    handles->a = a;
+    handles->capacity = maxHandles;
+    handles->freeEntry = maxHandles > 0 ? 0 : -1;
+    handles->usedBytes = 0;
+    handles->usage = NULL;
+
+    void* arena = HandleArena(space);
+    assert(size > (char*)arena - (char*)space);
+    for(BlockSize_t i = 0; i < maxHandles; i++)
+    {
+        Entry* entry = GetEntry(space, i + 1);
+        entry->ptr = NULL;
+        entry->pins = i + 1 < maxHandles ? i + 1 : -1;
+    }
+    a->Initialize(arena, size - ((char*)arena - (char*)space));
+}
+
+Handle HandleMalloc(void* space, BlockSize_t size)
+{
+    Handles* handles = GetHandles(space);
+    if(handles->freeEntry < 0)
+        return NO_HANDLE;
+
+    void* arena = HandleArena(space);
+    Prefix* prefix = (Prefix*) handles->a->Malloc(arena, size + sizeof(Prefix));
+    if(prefix == NULL)
+        return NO_HANDLE;
+    if(handles->usage)
+        TrackMalloc(handles->usage, arena, prefix);
+    handles->usedBytes += ABS(SeekBlockFromData(prefix)->size) + TAGS_SIZE;
+
+    Handle h = handles->freeEntry + 1;
+    Entry* entry = GetEntry(space, h);
+    handles->freeEntry = entry->pins;
+    entry->ptr = (void*) (prefix + 1);
+    entry->pins = 0;
+    prefix->handle = h;
+    return h;
+}
+
+void HandleFree(void* space, Handle h)
+{
+    if(h == NO_HANDLE)
+        return;
+
+    Handles* handles = GetHandles(space);
+    void* arena = HandleArena(space);
+    Entry* entry = GetEntry(space, h);
+    assert(entry->ptr != NULL && entry->pins == 0);
+
+    Prefix* prefix = GetPrefix(entry->ptr);
+    handles->usedBytes -= ABS(SeekBlockFromData(prefix)->size) + TAGS_SIZE;
+    if(handles->usage)
+        TrackFree(handles->usage, arena, prefix);
+    handles->a->Free(arena, prefix);
+
+    entry->ptr = NULL;
+    entry->pins = handles->freeEntry;
+    handles->freeEntry = h - 1;
+}
+
+void* Pin(void* space, Handle h)
+{
+    Entry* entry = GetEntry(space, h);
+    assert(entry->ptr != NULL);
+    entry->pins++;
+    return entry->ptr;
+}
+
+void Unpin(void* space, Handle h)
+{
+    Entry* entry = GetEntry(space, h);
+    assert(entry->ptr != NULL && entry->pins > 0);
+    entry->pins--;
+}
+
+BlockSize_t Compact(void* space)
+{
+    Handles* handles = GetHandles(space);
+    const Allocator* a = handles->a;
+    void* arena = HandleArena(space);
+    Block* p = SeekFirstBlock(arena);
+    char* end = (char*) Seek(p, GetSpaceSize(arena));
+    char* dst = (char*) p; // 下一个块挪到这里
+    BlockSize_t moved = 0;
+
+    // 按地址顺序走一遍所有的块
+    // 空闲块从算法的空闲结构中摘下，它们的空间由后面挪过来的块填上；
+    // 钉住的块不动，它前面剩下的空间成为一个新的空闲块。
+    // 这段空间至少有原来的一个空闲块那么大，算法一定放得下。
+    while((char*)p < end)
+    {
+        BlockSize_t total = ABS(p->size) + TAGS_SIZE;
+        Block* next = (Block*) Seek(p, total);
+        if(p->size >= 0)
+            a->TakeOff(arena, p);
+        else
+        {
+            Prefix* prefix = (Prefix*) p->data;
+            Entry* entry = GetEntry(space, prefix->handle);
+            if(entry->pins > 0)
+            {
+                ReleaseGap(handles, arena, dst, (char*) p);
+                dst = (char*) next;
+            }
+            else
+            {
+                if((char*)p != dst)
+                {
+                    memmove(dst, p, total);
+                    entry->ptr = (void*) ((Prefix*) ((Block*) dst)->data + 1);
+                    moved += total;
+                }
+                dst += total;
+            }
+        }
+        p = next;
+    }
+    ReleaseGap(handles, arena, dst, end);
+
+    // 空闲块变了，按整理后的内存重新统计
+    if(handles->usage)
+        RecountUsage(handles->usage, arena);
+    return moved;
+}
+
+BlockSize_t CompactableSpace(void* space)
+{
+    Handles* handles = GetHandles(space);
+    BlockSize_t rest = GetSpaceSize(HandleArena(space)) - handles->usedBytes;
+    return rest > (BlockSize_t)TAGS_SIZE ? rest - TAGS_SIZE : 0;
+}
+
+void TrackHandles(void* space, Usage* u)
+{
+    GetHandles(space)->usage = u;
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <assert.h>
+#include "memana.h"
+
+#define dp(p) printf(#p " = %p\n", (p))
+#define dd(d) printf(#d " = %I64d\n", (d))
+#define ABS(size) ((size) >= 0 ? (size) : -(size))
+#define BLOCK_MIN_SIZE (sizeof(Block) + sizeof(BlockSize_t))
+
+// 用堆实现的最坏适应
+// 空闲块组织成一个按大小排列的配对堆(pairing heap)，堆顶就是最大的空闲块，
+// 分配时直接取堆顶，查看最大空闲块只需要O(1)。
+// 堆的节点放在空闲块的数据区里，堆顶保存在原来空闲链表表头的位置。
+// 插入O(1)，删除均摊O(log n)。
+
+// 堆的节点，比链表节点多一个指针
+// 每个孩子链表中的第一个节点的prev指向父节点，其余节点的prev指向左边的兄弟
+typedef struct
+{
+    Block* child;
+    Block* sibling;
+    Block* prev;
+} HeapNode;
+
+#define HEAP(pBlock) ((HeapNode*)(pBlock)->data)
+#define CHILD(pBlock) (HEAP(pBlock)->child)
+#define SIBLING(pBlock) (HEAP(pBlock)->sibling)
+#define HPREV(pBlock) (HEAP(pBlock)->prev)
+
+// 空闲块的数据区至少要放得下一个堆节点
+#define HEAP_BLOCK_MIN_SIZE (2 * sizeof(BlockSize_t) + sizeof(HeapNode))
+
+
+// 合并两个堆，返回新的堆顶
+static Block* Meld(Block* a, Block* b)
+{
+    if(a == NULL)
+        return b;
+    if(b == NULL)
+        return a;
+    STAT(visited);
+    if(a->size < b->size)
+    {
+        Block* t = a;
+        a = b;
+        b = t;
+    }
+    // b成为a的第一个孩子
+    SIBLING(b) = CHILD(a);
+    if(CHILD(a))
+        HPREV(CHILD(a)) = b;
+    HPREV(b) = a;
+    CHILD(a) = b;
+    SIBLING(a) = NULL;
+    HPREV(a) = NULL;
+    return a;
+}
+
+// 把一串兄弟节点两两合并成一个堆，返回堆顶
+static Block* MergePairs(Block* first)
+{
+    // 从左到右两两合并，合并的结果用sibling倒着串起来
+    Block* pairs = NULL;
+    while(first)
+    {
+        Block* a = first;
+        Block* b = SIBLING(a);
+        first = b ? SIBLING(b) : NULL;
+        if(b)
+            SIBLING(b) = NULL;
+        SIBLING(a) = NULL;
+        a = Meld(a, b);
+        SIBLING(a) = pairs;
+        pairs = a;
+    }
+
+    // 再从右到左依次合并
+    Block* root = NULL;
+    while(pairs)
+    {
+        Block* next = SIBLING(pairs);
+        SIBLING(pairs) = NULL;
+        root = Meld(root, pairs);
+        pairs = next;
+    }
+    return root;
+}
+
+// 将空闲块插入堆中
+static void InsertBlock(void* space, Block* curr)
+{
+    CHILD(curr) = NULL;
+    SIBLING(curr) = NULL;
+    HPREV(curr) = NULL;
+    Block** pRoot = GetPtrToHeadPtr(space);
+    *pRoot = Meld(*pRoot, curr);
+}
+
+// 将空闲块从堆中摘下
+static void RemoveBlock(void* space, Block* curr)
+{
+    Block** pRoot = GetPtrToHeadPtr(space);
+    Block* sub = MergePairs(CHILD(curr));
+    if(curr == *pRoot)
+    {
+        *pRoot = sub;
+        return;
+    }
+
+    // 从父节点的孩子链表中断开
+    Block* prev = HPREV(curr);
+    if(CHILD(prev) == curr)
+        CHILD(prev) = SIBLING(curr);
+    else
+        SIBLING(prev) = SIBLING(curr);
+    if(SIBLING(curr))
+        HPREV(SIBLING(curr)) = prev;
+
+    *pRoot = Meld(*pRoot, sub);
+}
+
+
+// 初始化内存，整个内存作为一个空闲块，也是堆顶
+static void Initialize(void* space, BlockSize_t size)
+{
+    Block* pBlock = InitializeSpace(space, size, 0);
+    *GetPtrToHeadPtr(space) = NULL;
+    InsertBlock(space, pBlock);
+}
+
+
+static void* Malloc(void* space, BlockSize_t size)
+{
+    // 块被释放后要放得下堆节点
+    if(size < (BlockSize_t)sizeof(HeapNode))
+        size = sizeof(HeapNode);
+    size = AlignSize(size);
+
+    // 堆顶是最大的空闲块，它放不下就没有块放得下
+    Block* p = *GetPtrToHeadPtr(space);
+    if(p == NULL || p->size < size)
+        return NULL;
+
+    // 把块从堆中摘下，多余的部分拆成一个新的空闲块插回堆中
+    RemoveBlock(space, p);
+    if(p->size >= size + (BlockSize_t)HEAP_BLOCK_MIN_SIZE)
+        InsertBlock(space, SplitBlock(p, size));
+
+    SetBlockUsed(p);
+    return (void*) p->data;
+}
+
+static void Free(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+
+    // 找到分配出去的这个块，并设置为未使用
+    Block* curr = SeekBlockFromData(ptr);
+    SetBlockUnused(curr);
+
+    // 合并会改变块的大小，所以相邻的空闲块要先从堆中摘下，合并后再插回
+    curr = CoalesceBlocks(space, curr, RemoveBlock);
+    InsertBlock(space, curr);
+}
+
+// 返回最大空闲块的大小
+static BlockSize_t Largest(void* space)
+{
+    Block* root = *GetPtrToHeadPtr(space);
+    return root ? root->size : 0;
+}
+
+
+// 用堆实现的最坏适应算法的接口
+const Allocator HeapFit = { "heap", Initialize, Malloc, Free, Largest, RemoveBlock };
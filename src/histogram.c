@@ -0,0 +1,50 @@
+#include "histogram.h"
+
+
+static int Bucket(long long ns)
+{
+    if(ns < SUB_BUCKETS)
+        return (int) ns;
+    int shift = 63 - __builtin_clzll((unsigned long long) ns) - SUB_BITS;
+    return shift * SUB_BUCKETS + (int)(ns >> shift);
+}
+
+// the largest value that falls into bucket i
+static long long BucketTop(int i)
+{
+    if(i < SUB_BUCKETS)
+        return i;
+    int shift = i / SUB_BUCKETS - 1;
+    long long low = (long long)(i - shift * SUB_BUCKETS) << shift;
+    return low + (1LL << shift) - 1;
+}
+
+
+void Record(Histogram* h, long long ns)
+{
+    h->counts[Bucket(ns)]++;
+    h->n++;
+    h->sum += ns;
+    if(ns > h->max)
+        h->max = ns;
+}
+
+long long Percentile(const Histogram* h, double p)
+{
+    long long rank = (long long)(p / 100 * h->n + 0.5);
+    if(rank < 1)
+        rank = 1;
+    long long seen = 0;
+    for(int i = 0; i < BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if(seen >= rank)
+            return BucketTop(i) < h->max ? BucketTop(i) : h->max;
+    }
+    return h->max;
+}
+
+double Mean(const Histogram* h)
+{
+    return h->n ? (double) h->sum / h->n : 0.0;
+}
@@ -0,0 +1,29 @@
+#ifndef CONCURRENT_H_
+#define CONCURRENT_H_
+
+#include "memana.h"
+
+// 多线程共享的内存
+// 小块内存由每个线程自己的缓存分配和回收，不需要加锁；
+// 缓存不够时成批地从共享内存补充，缓存太多时成批地还回去，这两种情况才加锁；
+// 别的线程释放的小块通过无锁队列还给分配它的线程。
+// 所有的管理信息都放在space里，不会另外分配内存。
+
+// 每个线程的缓存占整数个缓存行，space要按这个字节数对齐
+#define SHARED_ALIGNMENT 64
+
+// 在space上用算法a建立一个多线程共享的内存
+void InitializeShared(const Allocator* a, void* space, BlockSize_t size);
+// 释放InitializeShared建立的锁，所有线程都不再使用space之后调用，
+// 之后才能在同一个space上重新InitializeShared
+void DestroyShared(void* space);
+
+void* SharedMalloc(void* space, BlockSize_t size);
+void SharedFree(void* space, void* ptr);
+
+// 把当前线程在space上缓存的内存全部还给共享内存
+// 线程退出时会自动调用
+void FlushThreadCache(void* space);
+
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef DEFERRED_H_
+#define DEFERRED_H_
+
+#include "memana.h"
+#include "usage.h"
+
+// 延迟合并的内存
+// 释放的块不马上还给算法，而是按请求的大小放进快速链表，同样大小的请求直接复用；
+// 只有分配失败而合并之后有可能放得下，或者快速链表里的块太多时，才一次全部还给算法合并。
+// 反复分配、释放同样大小的块时，省去了每次的合并和随后的再拆分。
+// 快速链表里的块在算法看来仍然是已使用的，所有的管理信息都放在space里。
+
+// 在space上用算法a建立一个延迟合并的内存
+// 是否合并延迟的块按释放时立即合并来估计，a不能是lazyMerge或者有Walk的算法
+void InitializeDeferred(const Allocator* a, void* space, BlockSize_t size);
+
+void* DeferredMalloc(void* space, BlockSize_t size);
+// size是分配时请求的大小，快速链表按它查找
+void DeferredFree(void* space, void* ptr, BlockSize_t size);
+
+// 把快速链表里的块全部还给算法
+void FlushDeferred(void* space);
+
+// 交给算法管理的内存
+void* DeferredArena(void* space);
+
+// 设置之后，算法真正的分配和释放都会记到u上，u要先用DeferredArena(space)初始化
+void TrackDeferred(void* space, Usage* u);
+
+typedef struct
+{
+    unsigned long long hits;    // 直接从快速链表分配的次数
+    unsigned long long flushes; // 批量合并的次数
+    BlockSize_t blocks;         // 快速链表里现在的块数
+    BlockSize_t bytes;          // 快速链表里现在的字节数
+} DeferredStats;
+
+DeferredStats GetDeferredStats(void* space);
+
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef HANDLE_H_
+#define HANDLE_H_
+
+#include "memana.h"
+#include "usage.h"
+
+// 可以移动的内存
+// 分配得到的是句柄而不是指针，要访问内存时先用Pin取得地址，用完后Unpin。
+// Compact把没有钉住的块都挪到内存前面，空闲的空间就合并成了整块，
+// 总的空闲空间够用、但没有一个空闲块放得下的请求，整理之后就能满足了。
+// 句柄表放在space开头，后面才是交给算法管理的内存。
+
+typedef BlockSize_t Handle;
+
+// 分配失败时返回的句柄
+#define NO_HANDLE 0
+
+// 在space上用算法a建立可以移动的内存，最多同时存在maxHandles个句柄
+// 整理内存依赖标准的块格式和释放时立即合并，a不能是lazyMerge或者有Walk的算法
+void InitializeHandles(const Allocator* a, void* space, BlockSize_t size, BlockSize_t maxHandles);
+
+Handle HandleMalloc(void* space, BlockSize_t size);
+void HandleFree(void* space, Handle h);
+
+// 钉住句柄并返回它现在的地址，在对应的Unpin之前这块内存不会被移动
+// 可以多次钉住，Unpin同样的次数之后才能移动
+void* Pin(void* space, Handle h);
+void Unpin(void* space, Handle h);
+
+// 整理内存，返回移动的字节数
+BlockSize_t Compact(void* space);
+
+// 整理之后能够合并出来的空闲空间，没有钉住的块时就是整理后最大空闲块的大小
+BlockSize_t CompactableSpace(void* space);
+
+// 交给算法管理的内存
+void* HandleArena(void* space);
+
+// 设置之后，分配和释放都会记到u上，u要先用HandleArena(space)初始化
+void TrackHandles(void* space, Usage* u);
+
+
+#endif
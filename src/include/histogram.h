@@ -0,0 +1,28 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+// Log-linear histogram of latencies in nanoseconds, like HdrHistogram:
+// every power of two above SUB_BUCKETS is cut into SUB_BUCKETS linear
+// buckets, so a value is kept with a relative error below 1/SUB_BUCKETS
+// in constant space and with a constant number of operations per record.
+#define SUB_BITS 5
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define BUCKETS ((64 - SUB_BITS) * SUB_BUCKETS + SUB_BUCKETS)
+
+typedef struct
+{
+    long long counts[BUCKETS];
+    long long n;
+    long long sum;
+    long long max;
+} Histogram;
+
+void Record(Histogram* h, long long ns);
+
+// p-th percentile (0 < p <= 100), exact up to the bucket width
+long long Percentile(const Histogram* h, double p);
+
+double Mean(const Histogram* h);
+
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef MAPPING_H_
+#define MAPPING_H_
+
+#include "memana.h"
+
+// 直接用mmap向操作系统要的内存
+// 只保留地址空间(MAP_NORESERVE)，页在第一次访问时才真正分配，
+// 算法初始化时只写内存头部和第一个块的首尾size，所以一开始几乎不占物理内存。
+// 可以要求使用大页，减少大内存上的TLB缺失；
+// 也可以把大的空闲块中间的整页还给操作系统，减少常驻内存。
+
+// 用MAP_HUGETLB分配大页，系统没有预留足够的大页时MapArena失败
+// 大页在映射时就全部预留，不是用到时才分配，只是第一次访问时才清零
+#define MAPPING_HUGETLB 1
+// 用madvise(MADV_HUGEPAGE)请求透明大页，系统不支持时照常使用普通页
+#define MAPPING_THP 2
+
+// 映射size字节的内存，按页对齐，失败时返回NULL并设置errno
+void* MapArena(BlockSize_t size, int flags);
+// 解除映射，size和flags要和MapArena时相同
+void UnmapArena(void* space, BlockSize_t size, int flags);
+
+// 内存按多大的页分配和释放
+BlockSize_t MappingPageSize(int flags);
+
+// 把算法a管理的space里不小于minSize的空闲块中间的整页还给操作系统，返回还回去的字节数
+// 空闲块开头的空闲结构节点和末尾的size保持不动，还回去的页下次访问时重新分配并清零
+BlockSize_t ReleaseFreePages(const Allocator* a, void* space, BlockSize_t minSize, int flags);
+
+// [space, space + size)里现在有多少字节在物理内存中
+BlockSize_t ResidentBytes(void* space, BlockSize_t size);
+
+
+#endif
@@ -1,9 +1,14 @@
 #ifndef MEMANA_H_
 #define MEMANA_H_
 
+#include <stdbool.h>
+
 
 typedef long long BlockSize_t;
 
+// 分配出去的内存默认按ALIGNMENT字节对齐
+#define ALIGNMENT 16
+
 struct Block_;
 
 typedef struct Block_ Block;
@@ -26,6 +31,7 @@ struct Block_
 
 Block** GetPtrToHeadPtr(void* space);
 BlockSize_t GetSpaceSize(void* space);
+void* GetExtraSpace(void* space);
 
 void* Seek(void* ptr, BlockSize_t offset);
 
@@ -38,6 +44,7 @@ Block* SeekBlockFromTailSize(BlockSize_t* pTailSize);
 Block* SeekBlockFromData(void* ptr);
 
 
+Block* SeekFirstBlock(void* space);
 Block* SeekNextBlock(void* space, Block* curr);
 Block* SeekPrevBlock(void* space, Block* curr);
 
@@ -48,10 +55,108 @@ void SetBlockUsed(Block* curr);
 void TakeOffBlock(void* space, Block* curr);
 
 Block* MergeAdjacentBlocks(void* space, Block* curr);
+Block* CoalesceBlocks(void* space, Block* curr, void (*takeOff)(void* space, Block* curr));
+
+Block* SplitBlock(Block* p, BlockSize_t size);
+
+Block* InitializeSpace(void* space, BlockSize_t size, BlockSize_t extra);
+
+BlockSize_t AlignSize(BlockSize_t size);
+
+
+// 统计信息，编译时定义了MEMANA_STATS才会收集，否则STAT不产生任何代码
+// 每个线程各自计数，多线程使用时不需要同步
+#ifdef MEMANA_STATS
+typedef struct
+{
+    unsigned long long visited; // 查找或调整位置时经过的空闲块数
+    unsigned long long splits;  // 拆分空闲块的次数
+    unsigned long long merges;  // 合并相邻空闲块的次数
+} Stats;
+
+extern _Thread_local Stats memanaStats;
+
+#define STAT(field) (memanaStats.field++)
+#else
+#define STAT(field) ((void) 0)
+#endif
 
-void Initialize(void* space, BlockSize_t size);
-void* Malloc(void* space, BlockSize_t size);
-void Free(void* space, void* ptr);
+
+// 一种分配算法对外提供的操作
+// 同一个进程里可以用不同的算法管理不同的内存
+typedef struct
+{
+    const char* name;
+    void (*Initialize)(void* space, BlockSize_t size);
+    void* (*Malloc)(void* space, BlockSize_t size);
+    void (*Free)(void* space, void* ptr);
+    // 最大空闲块的大小，只有能在O(1)内给出的算法才提供，否则为NULL
+    BlockSize_t (*Largest)(void* space);
+    // 把一个空闲块从算法的空闲结构中摘下
+    void (*TakeOff)(void* space, Block* curr);
+    // 释放时不一定和所有相邻的空闲块合并(比如伙伴系统)，为false时释放的块总会和两边的空闲块合并
+    // 整理内存依赖立即合并，不能用于这样的算法，使用情况也只能遍历内存统计
+    bool lazyMerge;
+    // 块不是标准的首尾size格式时(比如压缩了块头)，按地址顺序访问每个块，
+    // visit的参数是块的数据区、数据区大小和是否已使用；为NULL时块是标准格式
+    // 不是标准格式的算法只能通过Malloc/Free使用，直接操作块的功能都不能用于它
+    void (*Walk)(void* space, void (*visit)(void* ctx, void* data, BlockSize_t size, bool used), void* ctx);
+    // 内存里只保存偏移不保存地址，整个space换到别的按ALIGNMENT对齐的地址之后可以继续使用
+    bool relocatable;
+    // lazyMerge或者有Walk的算法自己实现的按align对齐分配，MallocAligned不能替它们切分块
+    void* (*MallocAligned)(void* space, BlockSize_t size, BlockSize_t align);
+    // 块不是标准格式时，分配出去的ptr能用的字节数；为NULL时由块的size得到
+    BlockSize_t (*DataSize)(void* space, void* ptr);
+} Allocator;
+
+extern const Allocator FirstFit;
+extern const Allocator NextFit;
+extern const Allocator BestFit;
+extern const Allocator WorstFit;
+extern const Allocator SegFit;
+extern const Allocator TreeFit;
+extern const Allocator HeapFit;
+extern const Allocator TlsfFit;
+extern const Allocator BuddyFit;
+extern const Allocator AddrFit;
+extern const Allocator CompactFit;
+
+// 所有算法，以NULL结尾
+extern const Allocator* const allocators[];
+
+// 按名字查找算法，找不到时返回NULL
+const Allocator* FindAllocator(const char* name);
+
+// 用算法a按align字节对齐分配内存，align必须是2的幂
+// lazyMerge或者有Walk的算法由它自己的MallocAligned分配
+void* MallocAligned(const Allocator* a, void* space, BlockSize_t size, BlockSize_t align);
+
+// 用算法a把ptr指向的内存调整为size字节，尽量原地完成，返回调整后的内存
+// 失败时返回NULL，原来的内存保持不变
+// lazyMerge或者有Walk的算法放得下时原样返回，否则重新分配并复制
+void* Realloc(const Allocator* a, void* space, void* ptr, BlockSize_t size);
+
+// 批量分配和释放时块的变化，ptr是块的数据区
+typedef enum
+{
+    BATCH_MALLOC, // 算法的Malloc刚分配出ptr
+    BATCH_FREE,   // 马上要用算法的Free释放ptr
+    BATCH_CUT,    // 一个已使用的块被切成两块，ptr是后一块
+    BATCH_JOIN,   // ptr并进了内存上紧挨在它前面的已使用的块
+} BatchEvent;
+
+// 每一步变化之后(BATCH_FREE是之前)调用，用来跟踪内存的使用情况，见usage.h
+typedef void (*BatchTrack)(void* ctx, void* space, void* ptr, BatchEvent event);
+
+// 用算法a一次分配n块内存，第i块至少sizes[i]字节，放在out[i]里，返回分配成功的块数
+// 有放得下整组的空闲块时一次切出所有的块，否则逐个分配，分配不到的out[i]为NULL
+// 每一块都可以单独释放，lazyMerge或者有Walk的算法总是逐个分配；track可以为NULL
+int MallocBatch(const Allocator* a, void* space, const BlockSize_t* sizes, int n, void** out,
+                BatchTrack track, void* ctx);
+
+// 用算法a一次释放ptrs里的n块内存，其中可以有NULL，ptrs会被按地址排序
+// 内存上相邻的块一起释放，lazyMerge或者有Walk的算法逐个释放；track可以为NULL
+void FreeBatch(const Allocator* a, void* space, void** ptrs, int n, BatchTrack track, void* ctx);
 
 
 
@@ -0,0 +1,42 @@
+#ifndef PERSIST_H_
+#define PERSIST_H_
+
+#include "memana.h"
+
+// 可以保存、共享的内存
+// space开头记下建立时用的算法和大小，后面是交给算法管理的内存。
+// 算法必须是relocatable的，内存里只保存偏移而不保存地址，
+// 所以整个space可以保存到文件后重新映射到别的地址，或者由几个进程同时映射(MAP_SHARED)。
+// 重新打开时Attach只检查开头的信息，空闲链表原样沿用，不需要重建。
+// 使用者在内存里同样只能保存偏移，用ToOffset/FromOffset和地址互相转换，
+// 自己的数据的入口可以用SetRoot记在开头的信息里。
+// 和算法本身一样不加锁，几个进程同时使用时要由使用者同步；
+// 分配或者释放到一半时进程退出，内存的状态不保证一致。
+
+// 在space上用算法a建立可以保存的内存，space按ALIGNMENT对齐
+void InitializePersistent(const Allocator* a, void* space, BlockSize_t size);
+
+// 检查space开头的信息是否完整，并且和size一致，返回建立时用的算法，不对时返回NULL
+const Allocator* Attach(void* space, BlockSize_t size);
+
+// 交给算法管理的内存
+void* PersistentArena(void* space);
+
+// 地址和相对space的偏移互相转换，NULL对应偏移0
+BlockSize_t ToOffset(void* space, void* ptr);
+void* FromOffset(void* space, BlockSize_t offset);
+
+// 使用者自己的数据的入口，建立时为0
+void SetRoot(void* space, BlockSize_t offset);
+BlockSize_t GetRoot(void* space);
+
+// 建立文件path并映射为size字节的内存，用算法a初始化，失败时返回NULL并设置errno
+void* CreateArenaFile(const char* path, const Allocator* a, BlockSize_t size);
+// 映射已有的文件path并Attach，*a设为建立时用的算法
+// 失败时返回NULL，文件不是这样建立的内存时errno为EINVAL
+void* OpenArenaFile(const char* path, const Allocator** a);
+// 把内存写回文件并解除映射
+void CloseArenaFile(void* space);
+
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SHARDED_H_
+#define SHARDED_H_
+
+#include "memana.h"
+
+// 分片的内存
+// 把一大块内存等分成若干个独立初始化的子内存，每个子内存有自己的锁。
+// 每个线程固定使用其中一个子内存分配，它不够时再去别的子内存里找；
+// 释放时按地址找到内存所属的子内存。
+// 所有的管理信息都放在space里，不会另外分配内存。
+
+// 子内存数量的上限
+#define MAX_ARENAS 64
+
+// 在space上建立nArenas个子内存，每个都用算法a管理
+void InitializeSharded(const Allocator* a, void* space, BlockSize_t size, int nArenas);
+// 释放各个子内存的锁，所有线程都不再使用space之后调用，
+// 之后才能在同一个space上重新InitializeSharded
+void DestroySharded(void* space);
+
+void* ShardedMalloc(void* space, BlockSize_t size);
+void ShardedFree(void* space, void* ptr);
+
+
+#endif
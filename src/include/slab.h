@@ -0,0 +1,38 @@
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include "memana.h"
+#include "usage.h"
+
+// 小对象的内存池
+// 不超过SLAB_MAX_SIZE字节的请求按16字节一级分成若干种大小，
+// 每种大小从算法那里整块地分配SLAB_SIZE字节的slab，再切成同样大小的槽位，
+// 槽位没有首尾size，空闲的槽位串成slab内部的链表，分配和释放都是O(1)。
+// slab里的槽位全部释放后整块还给算法(每种大小留一个，免得反复分配释放同一个slab)。
+// 更大的请求直接交给算法。所有的管理信息都放在space里。
+#define SLAB_MAX_SIZE 256
+#define SLAB_SIZE 4096
+
+// 在space上用算法a建立带内存池的内存
+void InitializeSlabs(const Allocator* a, void* space, BlockSize_t size);
+
+void* SlabMalloc(void* space, BlockSize_t size);
+void SlabFree(void* space, void* ptr);
+
+// 交给算法管理的内存
+void* SlabArena(void* space);
+
+// 设置之后，算法真正的分配和释放(包括slab本身)都会记到u上，u要先用SlabArena(space)初始化
+void TrackSlabs(void* space, Usage* u);
+
+typedef struct
+{
+    unsigned long long hits;  // 从slab分配的次数
+    BlockSize_t slabs;        // 现在从算法分配来的slab数
+    BlockSize_t objects;      // slab里现在已分配的槽位数
+} SlabStats;
+
+SlabStats GetSlabStats(void* space);
+
+
+#endif
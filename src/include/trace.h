@@ -0,0 +1,58 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdio.h>
+
+// A request of the trace, see problem_description.txt.
+typedef struct
+{
+    long long s; // arrived time
+    long long t; // use time
+    long long m;  // memory needed
+    void * ptr;
+
+} Request;
+
+// Binary traces start with a 32-byte little-endian header:
+//   "MTRC", u32 version, u64 n, u64 L, u64 reserved (0)
+// followed by n records of three LEB128 varints: the zigzag-encoded
+// difference of the arrival time to the previous one, the use time and the
+// memory needed.
+#define TRACE_MAGIC "MTRC"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 32
+
+// Reads a text or binary trace one request at a time; the file is mapped,
+// so only the pages being read need to be in memory.
+typedef struct
+{
+    long long n; // number of requests
+    long long L; // total memory in bytes
+    long long bytes; // size of the trace file
+    int binary;
+    long long read; // requests returned so far
+    long long last; // arrival time of the previous request
+    const char* map;
+    const char* released; // pages before this are dropped from memory
+    const char* p;
+    const char* end;
+} TraceReader;
+
+typedef struct
+{
+    FILE* file;
+    long long last;
+} TraceWriter;
+
+// Both return 0, or -1 with errno set (EINVAL when the file is malformed).
+int OpenTrace(const char* path, TraceReader* reader);
+// Returns 1 and fills in req, 0 after the last request, -1 on a malformed file.
+int ReadRequest(TraceReader* reader, Request* req);
+void CloseTrace(TraceReader* reader);
+
+// Writes a binary trace; requests go in the order they should be read back.
+int BeginTrace(TraceWriter* writer, FILE* file, long long n, long long L);
+int WriteRequest(TraceWriter* writer, const Request* req);
+
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef USAGE_H_
+#define USAGE_H_
+
+#include "memana.h"
+
+// 内存的使用情况
+// 每次分配之后调用TrackMalloc、每次释放之前调用TrackFree，都在O(1)内更新，
+// 不需要遍历内存。
+// 依赖算法在释放时立即合并相邻的空闲块：分配出去的块后面紧跟的空闲块
+// 一定是拆分剩下的部分，释放的块两边的空闲块一定会和它合并。
+// 对lazyMerge的算法这不成立，有Walk的算法的块也不是标准格式，
+// 这时TrackMalloc和TrackFree不做任何事，读取之前要调用RefreshUsage遍历内存重新统计。
+
+// 空闲块按大小分组记下块数和字节数，每个2的幂再等分成USAGE_SUB组，
+// 最大的空闲块被用掉之后由最高的非空分组得到新的最大空闲块，误差小于1/USAGE_SUB
+#define USAGE_SUB_BITS 4
+#define USAGE_SUB (1 << USAGE_SUB_BITS)
+#define USAGE_BUCKETS ((64 - USAGE_SUB_BITS) * USAGE_SUB + USAGE_SUB)
+
+typedef struct
+{
+    BlockSize_t usedBytes;  // 已分配块的数据区之和
+    BlockSize_t usedBlocks;
+    BlockSize_t freeBytes;  // 空闲块的数据区之和
+    BlockSize_t freeBlocks;
+    BlockSize_t headerBytes; // 内存头部和每个块的首尾size，也就是数据区以外的所有字节
+    BlockSize_t counts[USAGE_BUCKETS];
+    BlockSize_t bytes[USAGE_BUCKETS];
+    BlockSize_t largest;       // 最大空闲块的大小
+    BlockSize_t largestBlocks; // 大小为largest的空闲块数，为0时largest是估计值
+    const Allocator* walk;   // 只能遍历内存统计时是所用的算法，否则为NULL
+} Usage;
+
+// 在算法a->Initialize(space, ...)之后调用
+void InitializeUsage(Usage* u, const Allocator* a, void* space);
+
+// 遍历整个内存重新统计，用在整理内存这样改变了所有块的操作之后
+void RecountUsage(Usage* u, void* space);
+
+// 只能遍历内存统计时重新统计，否则什么都不做，在读取使用情况之前调用
+void RefreshUsage(Usage* u, void* space);
+
+// ptr是刚刚分配出去的内存，为NULL时什么都不做
+void TrackMalloc(Usage* u, void* space, void* ptr);
+// ptr是马上要释放的内存，为NULL时什么都不做
+void TrackFree(Usage* u, void* space, void* ptr);
+// MallocBatch和FreeBatch的track，ctx是Usage，每一步都在O(1)内更新
+void TrackBatch(void* ctx, void* space, void* ptr, BatchEvent event);
+
+// 最大空闲块的大小，不遍历内存
+// 算法能直接给出时由算法给出；否则记下的最大块还在，或者最高的非空分组里只有一块时是准确值，
+// 都不是时是这一组的平均大小，不超过真实值
+BlockSize_t UsageLargest(const Usage* u, const Allocator* a, void* space);
+
+// 外部碎片率：1 - 最大空闲块 / 空闲空间，没有空闲空间时为0
+double UsageFragmentation(const Usage* u, const Allocator* a, void* space);
+
+
+#endif
@@ -0,0 +1,106 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "mapping.h"
+
+#define ABS(size) ((size) >= 0 ? (size) : -(size))
+#define TAGS_SIZE (2 * sizeof(BlockSize_t))
+// x86-64上默认的大页大小
+#define HUGE_PAGE_SIZE ((BlockSize_t)2 << 20)
+// 空闲块开头留给空闲结构节点的字节数，和各个算法的最小空闲块一致
+#define NODE_KEEP_SIZE (2 * ALIGNMENT)
+// 空闲块末尾不动的字节数，压缩块头的格式把块尾写在数据区的最后4字节里
+#define TAIL_KEEP_SIZE ALIGNMENT
+
+// 遍历空闲块时带着的参数
+typedef struct
+{
+    BlockSize_t minSize;
+    BlockSize_t pageSize;
+    BlockSize_t released;
+} Release;
+
+
+BlockSize_t MappingPageSize(int flags)
+{
+    if(flags & MAPPING_HUGETLB)
+        return HUGE_PAGE_SIZE;
+    return sysconf(_SC_PAGESIZE);
+}
+
+static BlockSize_t RoundUp(BlockSize_t size, BlockSize_t page)
+{
+    return (size + page - 1) / page * page;
+}
+
+void* MapArena(BlockSize_t size, int flags)
+{
+    // 大页在映射时就要预留，预留不到时mmap失败；
+    // 加了MAP_NORESERVE就不预留，大页不够时要到访问那一页时才以SIGBUS结束进程
+    int mapFlags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if(flags & MAPPING_HUGETLB)
+        mapFlags |= MAP_HUGETLB;
+    else
+        mapFlags |= MAP_NORESERVE;
+    void* space = mmap(NULL, RoundUp(size, MappingPageSize(flags)), PROT_READ | PROT_WRITE, mapFlags, -1, 0);
+    if(space == MAP_FAILED)
+        return NULL;
+    // 透明大页只是建议，失败了也照常使用
+    if(flags & MAPPING_THP)
+        madvise(space, size, MADV_HUGEPAGE);
+    return space;
+}
+
+void UnmapArena(void* space, BlockSize_t size, int flags)
+{
+    munmap(space, RoundUp(size, MappingPageSize(flags)));
+}
+
+
+// 把一个空闲块中间的整页还回去
+static void ReleaseBlock(void* ctx, void* data, BlockSize_t size, bool used)
+{
+    Release* r = (Release*) ctx;
+    if(used || size < r->minSize)
+        return;
+    uintptr_t begin = RoundUp((uintptr_t)data + NODE_KEEP_SIZE, r->pageSize);
+    uintptr_t end = ((uintptr_t)data + size - TAIL_KEEP_SIZE) / r->pageSize * r->pageSize;
+    if(end <= begin)
+        return;
+    if(madvise((void*)begin, end - begin, MADV_DONTNEED) == 0)
+        r->released += end - begin;
+}
+
+BlockSize_t ReleaseFreePages(const Allocator* a, void* space, BlockSize_t minSize, int flags)
+{
+    Release r = { minSize, MappingPageSize(flags), 0 };
+    if(a->Walk)
+    {
+        a->Walk(space, ReleaseBlock, &r);
+        return r.released;
+    }
+    Block* p = SeekFirstBlock(space);
+    char* end = (char*) Seek(p, GetSpaceSize(space));
+    for(; (char*)p < end; p = (Block*) Seek(p, ABS(p->size) + TAGS_SIZE))
+        ReleaseBlock(&r, p->data, ABS(p->size), p->size < 0);
+    return r.released;
+}
+
+BlockSize_t ResidentBytes(void* space, BlockSize_t size)
+{
+    BlockSize_t page = sysconf(_SC_PAGESIZE);
+    BlockSize_t pages = RoundUp(size, page) / page;
+    BlockSize_t resident = 0;
+    unsigned char vec[4096];
+    for(BlockSize_t i = 0; i < pages; i += sizeof(vec))
+    {
+        BlockSize_t n = pages - i < (BlockSize_t)sizeof(vec) ? pages - i : (BlockSize_t)sizeof(vec);
+        if(mincore(Seek(space, i * page), n * page, vec) < 0)
+            return -1;
+        for(BlockSize_t j = 0; j < n; j++)
+            resident += vec[j] & 1;
+    }
+    return resident * page;
+}
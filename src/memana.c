@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include "memana.h"
 
@@ -9,7 +12,14 @@
 #define PREV(pBlock) ((pBlock)->node.prev)
 #define NEXT(pBlock) ((pBlock)->node.next)
 #define BLOCK_MIN_SIZE (sizeof(Block) + sizeof(BlockSize_t))
+// 放得下任何一种算法的空闲块节点的最小块大小
+#define NODE_MIN_SIZE (2 * ALIGNMENT)
+// 切出来还给算法的块的最小占用空间
+#define SLACK_MIN_SIZE (2 * sizeof(BlockSize_t) + NODE_MIN_SIZE)
 
+#ifdef MEMANA_STATS
+_Thread_local Stats memanaStats;
+#endif
 
 // 返回指向空闲链表表头指针的指针
 Block** GetPtrToHeadPtr(void* space)
@@ -23,6 +33,19 @@ BlockSize_t GetSpaceSize(void* space)
     return *(BlockSize_t*) Seek(space, sizeof(Block*));
 }
 
+// 返回算法在内存头部之后为自己保留的空间
+void* GetExtraSpace(void* space)
+{
+    return Seek(space, sizeof(Block*) + 2 * sizeof(BlockSize_t));
+}
+
+// 返回内存上的第一个块
+Block* SeekFirstBlock(void* space)
+{
+    BlockSize_t extra = *(BlockSize_t*) Seek(space, sizeof(Block*) + sizeof(BlockSize_t));
+    return (Block*) Seek(GetExtraSpace(space), extra);
+}
+
 // 指针寻址
 void* Seek(void* ptr, BlockSize_t offset)
 {
@@ -62,7 +85,7 @@ Block* SeekBlockFromData(void* ptr)
 // 找到当前块内存上连续相邻的前一个块
 Block* SeekPrevBlock(void* space, Block* curr)
 {
-    char* begin = (char*) Seek(space, sizeof(Block*) + sizeof(BlockSize_t));
+    char* begin = (char*) SeekFirstBlock(space);
     // 判断是否已经是最前面的块
     BlockSize_t diff = (char*)curr - begin;
     if(diff == 0)
@@ -76,13 +99,13 @@ Block* SeekPrevBlock(void* space, Block* curr)
 // 找到当前块内存上连续相邻的后一个块
 Block* SeekNextBlock(void* space, Block* curr)
 {
-    char* begin = (char*) Seek(space, sizeof(Block*) + sizeof(BlockSize_t));
+    char* begin = (char*) SeekFirstBlock(space);
     // 判断是否已经是最后面的块
     BlockSize_t size = GetSpaceSize(space);
     BlockSize_t diff = (char*)curr - begin;
-    if(size == diff + 2 * sizeof(BlockSize_t) + curr->size)
+    if(size == diff + 2 * sizeof(BlockSize_t) + ABS(curr->size))
         return NULL;
-    Block* next = (Block*) Seek(curr, 2 * sizeof(BlockSize_t) + curr->size);
+    Block* next = (Block*) Seek(curr, 2 * sizeof(BlockSize_t) + ABS(curr->size));
     if(next->size < 0)
         return NULL;
     return next;
@@ -130,6 +153,10 @@ void TakeOffBlock(void* space, Block* curr)
     // 循环链表
     if(prev == curr)
         *GetPtrToHeadPtr(space) = NULL;
+    // 循环链表没有首尾，摘下的如果正好是表头，就让下一个块成为表头
+    // 否则表头会指向一个已经被合并掉的块
+    else if(*GetPtrToHeadPtr(space) == curr)
+        *GetPtrToHeadPtr(space) = next;
 }
 
 // 将当前块与内存上连续前后相邻的块合并
@@ -140,6 +167,7 @@ Block* MergeAdjacentBlocks(void* space, Block* curr)
     {
         // 将前一个块的空间扩张，合并当前块
         // 首先设置块首部size的大小，然后让尾部size大小同步
+        STAT(merges);
         prev->size += 2 * sizeof(BlockSize_t) + curr->size;
         *SeekTailSize(prev) = prev->size;
         curr = prev;
@@ -149,6 +177,7 @@ Block* MergeAdjacentBlocks(void* space, Block* curr)
     {
         // 将当前块的空间扩张，合并后一个块
         // 首先设置块首部size的大小，然后让尾部size大小同步
+        STAT(merges);
         TakeOffBlock(space, next);
         curr->size += 2 * sizeof(BlockSize_t) + next->size;
         *SeekTailSize(curr) = curr->size;
@@ -156,4 +185,353 @@ Block* MergeAdjacentBlocks(void* space, Block* curr)
     return curr;
 }
 
+// 与MergeAdjacentBlocks相同，但前后相邻的空闲块都会先用takeOff从空闲结构中摘下，
+// 返回的合并块不在任何空闲结构中，由调用者按自己的方式挂回
+// 用于不能让前一个块原地变大的算法(比如按大小分组的空闲链表)
+Block* CoalesceBlocks(void* space, Block* curr, void (*takeOff)(void* space, Block* curr))
+{
+    Block* prev = SeekPrevBlock(space, curr);
+    if(prev)
+    {
+        STAT(merges);
+        takeOff(space, prev);
+        prev->size += 2 * sizeof(BlockSize_t) + curr->size;
+        *SeekTailSize(prev) = prev->size;
+        curr = prev;
+    }
+    Block* next = SeekNextBlock(space, curr);
+    if(next)
+    {
+        STAT(merges);
+        takeOff(space, next);
+        curr->size += 2 * sizeof(BlockSize_t) + next->size;
+        *SeekTailSize(curr) = curr->size;
+    }
+    return curr;
+}
+
+// 把空闲块p拆成两块，前一块大小为size，后一块是剩下的部分
+// 返回剩下的块；如果剩下的空间放不下一个新块，就不拆分并返回NULL
+// 两个块都保持未使用，也都不会挂到空闲结构上
+Block* SplitBlock(Block* p, BlockSize_t size)
+{
+    if(p->size < size + (BlockSize_t)BLOCK_MIN_SIZE)
+        return NULL;
+
+    STAT(splits);
+    BlockSize_t* pTailSize = SeekTailSize(p);
+    *pTailSize = p->size - size - 2 * sizeof(BlockSize_t);
+    *SeekHeadSizeFromTailSize(pTailSize) = *pTailSize;
+
+    p->size = size;
+    *SeekTailSize(p) = size;
+    return SeekBlockFromTailSize(pTailSize);
+}
+
+// 初始化内存头部，在头部写入可用内存大小，并在头部之后保留extra字节给算法使用
+// 剩下的内存成为一个空闲块，返回这个块，由调用者挂到空闲结构上
+Block* InitializeSpace(void* space, BlockSize_t size, BlockSize_t extra)
+{
+    // 块的首部size之后就是分配出去的内存，要让它按ALIGNMENT对齐，
+    // 第一个块的首部必须落在对齐位置之前sizeof(BlockSize_t)字节处，
+    // 多出来的字节算进保留空间
+    char* end = (char*) Seek(space, size);
+    uintptr_t data = (uintptr_t) Seek(GetExtraSpace(space), extra + sizeof(BlockSize_t));
+    extra += (ALIGNMENT - data % ALIGNMENT) % ALIGNMENT;
+
+    BlockSize_t header = sizeof(Block*) + 2 * sizeof(BlockSize_t) + extra;
+    assert(size >= header + 2 * sizeof(BlockSize_t) + sizeof(Block));
+    *(BlockSize_t*) Seek(space, sizeof(Block*) + sizeof(BlockSize_t)) = extra;
+
+    // 这个Block的可用大小要扣掉头尾两个存放size的空间，并且是ALIGNMENT的整数倍，
+    // 这样后面拆分出来的块也都是对齐的
+    Block* pBlock = SeekFirstBlock(space);
+    pBlock->size = (end - (char*)pBlock - 2 * sizeof(BlockSize_t)) / ALIGNMENT * ALIGNMENT;
+
+    // 写入可用内存大小(从第一个块开始算起，末尾不足对齐的零头不再使用)
+    BlockSize_t* pSpaceSize = (BlockSize_t*) Seek(space, sizeof(Block*));
+    *pSpaceSize = pBlock->size + 2 * sizeof(BlockSize_t);
+
+    // 设置尾部的size，头尾size始终要相同
+    *SeekTailSize(pBlock) = pBlock->size;
+
+    *GetPtrToHeadPtr(space) = pBlock;
+    return pBlock;
+}
+
+// 把请求的大小向上取整到ALIGNMENT的整数倍
+// 块被释放后要放得下链表节点，所以至少是一个链表节点的大小
+BlockSize_t AlignSize(BlockSize_t size)
+{
+    if(size < (BlockSize_t)sizeof(struct Node))
+        size = sizeof(struct Node);
+    return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// 分配出去的块的数据区大小，块被释放后要放得下任何一种算法的节点
+static BlockSize_t UsableSize(BlockSize_t size)
+{
+    size = AlignSize(size);
+    if(size < (BlockSize_t)NODE_MIN_SIZE)
+        size = NODE_MIN_SIZE;
+    return size;
+}
+
+// 把已使用的块p从offset处切开，后一半成为一个新的已使用块并返回
+// offset是新块的首部相对p的偏移
+static Block* CutUsedBlock(Block* p, BlockSize_t offset)
+{
+    BlockSize_t size = -p->size;
+    Block* q = (Block*) Seek(p, offset);
+
+    p->size = -(offset - 2 * (BlockSize_t)sizeof(BlockSize_t));
+    *SeekTailSize(p) = p->size;
+    q->size = -(size - offset);
+    *SeekTailSize(q) = q->size;
+    return q;
+}
+
+// 把已使用的块p的大小设为size，头尾size同步
+static void SetUsedSize(Block* p, BlockSize_t size)
+{
+    p->size = -size;
+    *SeekTailSize(p) = -size;
+}
+
+// 已使用的块p多出size之后的部分足够组成一个块时，切下来还给算法
+static void TrimUsedBlock(const Allocator* a, void* space, Block* p, BlockSize_t size)
+{
+    if(-p->size - size >= (BlockSize_t)SLACK_MIN_SIZE)
+    {
+        Block* q = CutUsedBlock(p, size + 2 * sizeof(BlockSize_t));
+        a->Free(space, q->data);
+    }
+}
+
+// 按align对齐分配size字节，align必须是2的幂
+// 先用算法自己的Malloc多分配一些，然后把前面为了对齐空出来的部分
+// 和后面多余的部分切成单独的块，再用算法自己的Free还回去，
+// 所以这些空间会和相邻的空闲块合并，不会浪费
+void* MallocAligned(const Allocator* a, void* space, BlockSize_t size, BlockSize_t align)
+{
+    assert(align > 0 && (align & (align - 1)) == 0);
+    if(align <= ALIGNMENT)
+        return a->Malloc(space, size);
+    if(a->lazyMerge || a->Walk)
+    {
+        assert(a->MallocAligned);
+        return a->MallocAligned(space, size, align);
+    }
+
+    // 切剩下的块以后也会被这个算法释放，所以同样不能太小
+    size = UsableSize(size);
+
+    // 前面空出来的部分至少要能组成一个块
+    char* ptr = (char*) a->Malloc(space, size + align + SLACK_MIN_SIZE);
+    if(ptr == NULL)
+        return NULL;
+    Block* p = SeekBlockFromData(ptr);
+
+    if((uintptr_t)ptr % align != 0)
+    {
+        uintptr_t aligned = ((uintptr_t)ptr + SLACK_MIN_SIZE + align - 1) / align * align;
+        Block* q = CutUsedBlock(p, aligned - (uintptr_t)ptr);
+        a->Free(space, ptr);
+        p = q;
+    }
+
+    // 后面多余的部分足够组成一个块时也还回去
+    TrimUsedBlock(a, space, p, size);
+    return (void*) p->data;
+}
+
+// 重新分配size字节，复制原来的curr字节之后释放ptr，失败时ptr保持不变
+static void* Reallocate(const Allocator* a, void* space, void* ptr, BlockSize_t curr, BlockSize_t size)
+{
+    void* q = a->Malloc(space, size);
+    if(q == NULL)
+        return NULL;
+    memcpy(q, ptr, curr);
+    a->Free(space, ptr);
+    return q;
+}
+
+// 调整已分配内存的大小
+// 缩小时把多余的部分切下来还给算法；
+// 扩大时先尝试并入内存上紧随其后的空闲块，再尝试并入前面的空闲块(需要移动数据)，
+// 都不够时才重新分配并复制
+// 并入的空闲块用算法自己的TakeOff摘下，切下来的部分用算法自己的Free还回去，
+// 所以各个算法空闲结构的性质(比如有序)都能保持
+void* Realloc(const Allocator* a, void* space, void* ptr, BlockSize_t size)
+{
+    if(ptr == NULL)
+        return a->Malloc(space, size);
+
+    // 不能切分和并入块的算法，放不下时只能重新分配
+    if(a->lazyMerge || a->Walk)
+    {
+        BlockSize_t curr = a->DataSize ? a->DataSize(space, ptr) : -SeekBlockFromData(ptr)->size;
+        if(size <= curr)
+            return ptr;
+        return Reallocate(a, space, ptr, curr, size);
+    }
+
+    size = UsableSize(size);
+
+    Block* p = SeekBlockFromData(ptr);
+    BlockSize_t curr = -p->size;
+
+    // 缩小，或者本来就够大
+    if(size <= curr)
+    {
+        TrimUsedBlock(a, space, p, size);
+        return ptr;
+    }
+
+    // 并入后面的空闲块
+    Block* next = SeekNextBlock(space, p);
+    BlockSize_t nextSize = next ? 2 * sizeof(BlockSize_t) + next->size : 0;
+    if(next && curr + nextSize >= size)
+    {
+        a->TakeOff(space, next);
+        SetUsedSize(p, curr + nextSize);
+        TrimUsedBlock(a, space, p, size);
+        return ptr;
+    }
+
+    // 并入前面的空闲块(如果需要，后面的空闲块也一起并入)，数据要向前移动
+    Block* prev = SeekPrevBlock(space, p);
+    BlockSize_t prevSize = prev ? 2 * sizeof(BlockSize_t) + prev->size : 0;
+    if(prev && prevSize + curr >= size)
+        nextSize = 0;
+    if(prev && prevSize + curr + nextSize >= size)
+    {
+        a->TakeOff(space, prev);
+        if(nextSize)
+            a->TakeOff(space, next);
+        memmove(prev->data, ptr, curr);
+        SetUsedSize(prev, prevSize + curr + nextSize);
+        TrimUsedBlock(a, space, prev, size);
+        return (void*) prev->data;
+    }
+
+    // 只能重新分配
+    return Reallocate(a, space, ptr, curr, size);
+}
+
+// 有track时通知它块的变化
+#define TRACK(ptr, event) do { if(track) track(ctx, space, (ptr), (event)); } while(0)
+
+// 一次分配一组内存
+// 整组只用算法自己的Malloc分配一个大块，再从前往后切成n个已使用的块，
+// 最后一块多余的部分和MallocAligned一样切下来还回去，
+// 这样一组请求只查找一次空闲结构，而且在内存上连在一起
+// 不能切分块的算法只能逐个分配
+int MallocBatch(const Allocator* a, void* space, const BlockSize_t* sizes, int n, void** out,
+                BatchTrack track, void* ctx)
+{
+    if(n <= 0)
+        return 0;
+
+    // 整组占用的空间：各块的数据区，加上块与块之间的首尾size
+    BlockSize_t total = -2 * (BlockSize_t)sizeof(BlockSize_t);
+    for(int i = 0; i < n; i++)
+        total += UsableSize(sizes[i]) + 2 * sizeof(BlockSize_t);
+
+    char* ptr = NULL;
+    if(n > 1 && !a->lazyMerge && a->Walk == NULL && (a->Largest == NULL || a->Largest(space) >= total))
+        ptr = (char*) a->Malloc(space, total);
+    if(ptr)
+    {
+        TRACK(ptr, BATCH_MALLOC);
+        Block* p = SeekBlockFromData(ptr);
+        for(int i = 0; i < n - 1; i++)
+        {
+            out[i] = (void*) p->data;
+            p = CutUsedBlock(p, UsableSize(sizes[i]) + 2 * sizeof(BlockSize_t));
+            TRACK(p->data, BATCH_CUT);
+        }
+        out[n - 1] = (void*) p->data;
 
+        // 和TrimUsedBlock相同，只是每一步都要通知track
+        BlockSize_t size = UsableSize(sizes[n - 1]);
+        if(-p->size - size >= (BlockSize_t)SLACK_MIN_SIZE)
+        {
+            Block* q = CutUsedBlock(p, size + 2 * sizeof(BlockSize_t));
+            TRACK(q->data, BATCH_CUT);
+            TRACK(q->data, BATCH_FREE);
+            a->Free(space, q->data);
+        }
+        return n;
+    }
+
+    // 没有放得下整组的块，只能逐个分配
+    int k = 0;
+    for(int i = 0; i < n; i++)
+    {
+        out[i] = a->Malloc(space, sizes[i]);
+        if(out[i])
+        {
+            TRACK(out[i], BATCH_MALLOC);
+            k++;
+        }
+    }
+    return k;
+}
+
+static int CompareAddress(const void* x, const void* y)
+{
+    uintptr_t p = (uintptr_t) *(void* const*)x;
+    uintptr_t q = (uintptr_t) *(void* const*)y;
+    return (p > q) - (p < q);
+}
+
+// 一次释放一组内存
+// 按地址排序之后，内存上连续的一段已使用的块先连成一块，
+// 每段只调用一次算法自己的Free，和两边的空闲块合并、挂回空闲结构也都只有一次
+// 不能把块连起来的算法只能逐个释放
+void FreeBatch(const Allocator* a, void* space, void** ptrs, int n, BatchTrack track, void* ctx)
+{
+    qsort(ptrs, n, sizeof(void*), CompareAddress);
+
+    int i = 0;
+    // NULL排在最前面
+    while(i < n && ptrs[i] == NULL)
+        i++;
+    if(a->lazyMerge || a->Walk)
+    {
+        for(; i < n; i++)
+        {
+            TRACK(ptrs[i], BATCH_FREE);
+            a->Free(space, ptrs[i]);
+        }
+        return;
+    }
+    while(i < n)
+    {
+        Block* p = SeekBlockFromData(ptrs[i++]);
+        BlockSize_t size = -p->size;
+        // 紧随其后的块也在这一组里时并进来
+        while(i < n && (char*)ptrs[i] == p->data + size + 2 * sizeof(BlockSize_t))
+        {
+            STAT(merges);
+            TRACK(ptrs[i], BATCH_JOIN);
+            size += -SeekBlockFromData(ptrs[i++])->size + 2 * sizeof(BlockSize_t);
+        }
+        SetUsedSize(p, size);
+        TRACK(p->data, BATCH_FREE);
+        a->Free(space, p->data);
+    }
+}
+
+
+const Allocator* const allocators[] = { &FirstFit, &NextFit, &BestFit, &WorstFit, &SegFit, &TreeFit, &HeapFit, &TlsfFit, &BuddyFit, &AddrFit, &CompactFit, NULL };
+
+// 按名字查找算法，找不到时返回NULL
+const Allocator* FindAllocator(const char* name)
+{
+    for(int i = 0; allocators[i]; i++)
+        if(strcmp(allocators[i]->name, name) == 0)
+            return allocators[i];
+    return NULL;
+}
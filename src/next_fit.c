@@ -11,36 +11,21 @@
 
 
 // 初始化内存，在内存头部写入可用内存大小和空闲链表表头地址
-void Initialize(void* space, BlockSize_t size)
+static void Initialize(void* space, BlockSize_t size)
 {
-    assert(size >= sizeof(Block*) + 2 * sizeof(BlockSize_t) + sizeof(Block));
-
-    // 写入可用内存大小（去掉开头的两个元数据后所剩大小)
-    BlockSize_t* pSpaceSize = (BlockSize_t*) Seek(space, sizeof(Block*));
-    *pSpaceSize = size - sizeof(Block*) - sizeof(BlockSize_t);
-
-    // 写入第一个Block的地址，作为空闲链表表头
-    Block** pHeadPtr = GetPtrToHeadPtr(space);
-    *pHeadPtr = (Block*) Seek(space, sizeof(Block*) + sizeof(BlockSize_t));
-
-    // 初始化第一个Block
+    // 整个内存作为一个空闲块，也是空闲链表的表头
+    Block* pBlock = InitializeSpace(space, size, 0);
     // 循环首次适应需要使用循环链表
-    Block* pBlock = *pHeadPtr;
     PREV(pBlock) = pBlock;
     NEXT(pBlock) = pBlock;
-
-    // 这个Block的可用大小要扣掉头尾两个存放size的空间
-    BlockSize_t* pHeadSize = SeekHeadSize(pBlock);
-    *pHeadSize = *pSpaceSize - 2 * sizeof(BlockSize_t);
-
-    // 设置尾部的size，头尾size始终要相同
-    BlockSize_t* pTailSize = SeekTailSize(pBlock);
-    *pTailSize = *pHeadSize;
 }
 
 
-void* Malloc(void* space, BlockSize_t size)
+static void* Malloc(void* space, BlockSize_t size)
 {
+    // 按对齐要求取整，这样拆分出来的块也都是对齐的
+    size = AlignSize(size);
+
     // 查找第一个空间足够的空闲块
     Block* head = *GetPtrToHeadPtr(space);
     Block* p = head;
@@ -49,6 +34,7 @@ void* Malloc(void* space, BlockSize_t size)
     // 否则继续向后找直到回到开始位置
     if(p && p->size < size)
         do{
+            STAT(visited);
             p = NEXT(p);
         } while(p != head && p->size < size);
 
@@ -62,6 +48,7 @@ void* Malloc(void* space, BlockSize_t size)
     Block *prev = PREV(p), *next = NEXT(p);
     if(p->size >= size + BLOCK_MIN_SIZE)
     {
+        STAT(splits);
         BlockSize_t* pHeadSize = SeekHeadSize(p);
         BlockSize_t* pTailSize = SeekTailSize(p);
         assert(*pHeadSize == *pTailSize);
@@ -118,7 +105,7 @@ void* Malloc(void* space, BlockSize_t size)
 }
 
 
-void Free(void* space, void* ptr)
+static void Free(void* space, void* ptr)
 {
     if(ptr == NULL)
         return;
@@ -153,9 +140,5 @@ void Free(void* space, void* ptr)
 }
 
 
-
-
-
-
-
-
+// 循环首次适应算法的接口
+const Allocator NextFit = { "next", Initialize, Malloc, Free, NULL, TakeOffBlock };
@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "persist.h"
+
+#define MAGIC "MEMANA\r\n"
+#define VERSION 1
+#define NAME_SIZE 16
+
+// 放在space开头的信息，后面才是交给算法管理的内存
+// 只有定长的字段，不保存任何地址
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t alignment;   // 建立时的ALIGNMENT，块的格式和它有关
+    BlockSize_t size;     // 整个space的大小
+    char name[NAME_SIZE]; // 算法的名字
+    BlockSize_t root;
+} Persistent;
+
+
+static Persistent* GetPersistent(void* space)
+{
+    return (Persistent*) space;
+}
+
+
+void* PersistentArena(void* space)
+{
+    return Seek(space, (sizeof(Persistent) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+}
+
+void InitializePersistent(const Allocator* a, void* space, BlockSize_t size)
+{
+    assert(a->relocatable);
+    assert(strlen(a->name) < NAME_SIZE);
+    assert((uintptr_t)space % ALIGNMENT == 0);
+    Persistent* persistent = GetPersistent(space);
+    void* arena = PersistentArena(space);
+    assert(size > (char*)arena - (char*)space);
+
+    // 算法初始化完成之后才写入标记，中途失败的内存不会被当成完整的
+    memset(persistent, 0, sizeof(Persistent));
+    a->Initialize(arena, size - ((char*)arena - (char*)space));
+
+    persistent->version = VERSION;
+    persistent->alignment = ALIGNMENT;
+    persistent->size = size;
+    strcpy(persistent->name, a->name);
+    persistent->root = 0;
+    memcpy(persistent->magic, MAGIC, sizeof(persistent->magic));
+}
+
+const Allocator* Attach(void* space, BlockSize_t size)
+{
+    Persistent* persistent = GetPersistent(space);
+    void* arena = PersistentArena(space);
+    // 至少要有开头的信息和算法的内存头部
+    BlockSize_t header = (char*)arena - (char*)space + sizeof(Block*) + 2 * sizeof(BlockSize_t);
+    if(size < header || (uintptr_t)space % ALIGNMENT != 0)
+        return NULL;
+    if(memcmp(persistent->magic, MAGIC, sizeof(persistent->magic)) != 0
+        || persistent->version != VERSION || persistent->alignment != ALIGNMENT
+        || persistent->size != size || memchr(persistent->name, '\0', NAME_SIZE) == NULL)
+        return NULL;
+
+    const Allocator* a = FindAllocator(persistent->name);
+    if(a == NULL || !a->relocatable)
+        return NULL;
+    // 算法记下的可用大小不能超出space
+    BlockSize_t spaceSize = GetSpaceSize(arena);
+    BlockSize_t first = (char*)SeekFirstBlock(arena) - (char*)space;
+    if(spaceSize <= 0 || first < header || first > size - spaceSize)
+        return NULL;
+    return a;
+}
+
+BlockSize_t ToOffset(void* space, void* ptr)
+{
+    return ptr ? (char*)ptr - (char*)space : 0;
+}
+
+void* FromOffset(void* space, BlockSize_t offset)
+{
+    return offset ? Seek(space, offset) : NULL;
+}
+
+void SetRoot(void* space, BlockSize_t offset)
+{
+    GetPersistent(space)->root = offset;
+}
+
+BlockSize_t GetRoot(void* space)
+{
+    return GetPersistent(space)->root;
+}
+
+
+void* CreateArenaFile(const char* path, const Allocator* a, BlockSize_t size)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return NULL;
+    // 文件是稀疏的，只有写过的页才占磁盘
+    if(ftruncate(fd, size) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    void* space = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(space == MAP_FAILED)
+        return NULL;
+    InitializePersistent(a, space, size);
+    return space;
+}
+
+void* OpenArenaFile(const char* path, const Allocator** a)
+{
+    int fd = open(path, O_RDWR);
+    if(fd < 0)
+        return NULL;
+    struct stat st;
+    if(fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    if(st.st_size < (off_t) sizeof(Persistent))
+    {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    void* space = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(space == MAP_FAILED)
+        return NULL;
+
+    *a = Attach(space, st.st_size);
+    if(*a == NULL)
+    {
+        munmap(space, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    return space;
+}
+
+void CloseArenaFile(void* space)
+{
+    BlockSize_t size = GetPersistent(space)->size;
+    msync(space, size, MS_SYNC);
+    munmap(space, size);
+}
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <assert.h>
+#include "memana.h"
+
+#define dp(p) printf(#p " = %p\n", (p))
+#define dd(d) printf(#d " = %I64d\n", (d))
+#define ABS(size) ((size) >= 0 ? (size) : -(size))
+#define PREV(pBlock) ((pBlock)->node.prev)
+#define NEXT(pBlock) ((pBlock)->node.next)
+#define BLOCK_MIN_SIZE (sizeof(Block) + sizeof(BlockSize_t))
+
+// 分组适应：空闲块按大小分到64个组里，第i组存放大小在[2^i, 2^(i+1))内的块
+// 每组是一条双向链表，另外用一个位图记录哪些组不为空
+// 比请求所在组更大的组里的任何一个块都一定放得下，
+// 所以一般情况下只需要一次位扫描就能找到空闲块，不用遍历链表
+#define BIN_COUNT 64
+
+// 保存在内存头部之后的分组信息
+typedef struct
+{
+    unsigned long long bitmap;
+    Block* bins[BIN_COUNT];
+} Bins;
+
+
+static Bins* GetBins(void* space)
+{
+    return (Bins*) GetExtraSpace(space);
+}
+
+// 返回大小为size的块所属的组
+static int BinIndex(BlockSize_t size)
+{
+    return 63 - __builtin_clzll((unsigned long long) size);
+}
+
+// 将空闲块挂到它所属组的链表头部
+static void InsertBlock(void* space, Block* curr)
+{
+    Bins* bins = GetBins(space);
+    int i = BinIndex(curr->size);
+    Block* head = bins->bins[i];
+
+    PREV(curr) = NULL;
+    NEXT(curr) = head;
+    if(head)
+        PREV(head) = curr;
+    bins->bins[i] = curr;
+    bins->bitmap |= 1ULL << i;
+}
+
+// 将空闲块从它所属组的链表中摘下，组变空时清掉位图中对应的位
+static void RemoveBlock(void* space, Block* curr)
+{
+    Bins* bins = GetBins(space);
+    int i = BinIndex(curr->size);
+
+    if(PREV(curr))
+        NEXT(PREV(curr)) = NEXT(curr);
+    else
+        bins->bins[i] = NEXT(curr);
+    if(NEXT(curr))
+        PREV(NEXT(curr)) = PREV(curr);
+
+    if(bins->bins[i] == NULL)
+        bins->bitmap &= ~(1ULL << i);
+}
+
+// 找一个放得下size的空闲块，找不到时返回NULL
+static Block* FindBlock(void* space, BlockSize_t size)
+{
+    Bins* bins = GetBins(space);
+    int i = BinIndex(size);
+
+    // 先看更大的组，取其中任意一块都可以
+    unsigned long long larger = i + 1 < BIN_COUNT ? bins->bitmap & (~0ULL << (i + 1)) : 0;
+    if(larger)
+        return bins->bins[__builtin_ctzll(larger)];
+
+    // 没有更大的组，只能在同一组里按首次适应查找
+    Block* p = bins->bins[i];
+    while(p && p->size < size)
+    {
+        STAT(visited);
+        p = NEXT(p);
+    }
+    return p;
+}
+
+
+// 初始化内存，在内存头部之后保存分组信息
+static void Initialize(void* space, BlockSize_t size)
+{
+    Bins* bins = GetBins(space);
+    Block* pBlock = InitializeSpace(space, size, sizeof(Bins));
+
+    bins->bitmap = 0;
+    for(int i = 0; i < BIN_COUNT; i++)
+        bins->bins[i] = NULL;
+    InsertBlock(space, pBlock);
+}
+
+
+static void* Malloc(void* space, BlockSize_t size)
+{
+    // 按对齐要求取整，块被释放后也要放得下链表节点
+    size = AlignSize(size);
+
+    Block* p = FindBlock(space, size);
+    if(p == NULL)
+        return NULL;
+
+    // 把块从组中摘下，多余的部分拆成一个新的空闲块挂回对应的组
+    RemoveBlock(space, p);
+    Block* rest = SplitBlock(p, size);
+    if(rest)
+        InsertBlock(space, rest);
+
+    SetBlockUsed(p);
+    return (void*) p->data;
+}
+
+static void Free(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+
+    // 找到分配出去的这个块，并设置为未使用
+    Block* curr = SeekBlockFromData(ptr);
+    SetBlockUnused(curr);
+
+    // 合并后块的大小会变化，所在的组也可能变化
+    // 所以相邻的空闲块先从各自的组中摘下，合并后再挂回
+    curr = CoalesceBlocks(space, curr, RemoveBlock);
+    InsertBlock(space, curr);
+}
+
+
+// 分组适应算法的接口
+const Allocator SegFit = { "seg", Initialize, Malloc, Free, NULL, RemoveBlock };
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include "sharded.h"
+
+// 放在space开头的分片信息，后面依次是各个子内存
+typedef struct
+{
+    const Allocator* a;
+    int nArenas;
+    BlockSize_t arenaSize;
+    atomic_int nextArena; // 给新线程分配子内存用的计数器
+    unsigned long long generation; // 每次InitializeSharded都不同
+    mtx_t locks[MAX_ARENAS];
+} Sharded;
+
+// 所有分片内存的初始化次数，用来给每次初始化一个不同的generation
+static atomic_ullong generations;
+
+// 当前线程使用的子内存编号，以及它属于哪块space的哪次初始化
+// 换了一块space或者space重新初始化过，都要重新轮流指定
+static _Thread_local int localArena;
+static _Thread_local void* localSpace;
+static _Thread_local unsigned long long localGeneration;
+
+
+static Sharded* GetSharded(void* space)
+{
+    return (Sharded*) space;
+}
+
+// 返回第i个子内存
+static void* GetArena(void* space, int i)
+{
+    BlockSize_t header = (sizeof(Sharded) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    return Seek(space, header + i * GetSharded(space)->arenaSize);
+}
+
+// 当前线程在space上使用的子内存，线程第一次在这块space上分配时轮流指定
+static int PickArena(void* space)
+{
+    Sharded* sharded = GetSharded(space);
+    if(localSpace != space || localGeneration != sharded->generation)
+    {
+        localArena = atomic_fetch_add(&sharded->nextArena, 1) % sharded->nArenas;
+        localSpace = space;
+        localGeneration = sharded->generation;
+    }
+    return localArena;
+}
+
+static void* MallocFrom(void* space, int i, BlockSize_t size)
+{
+    Sharded* sharded = GetSharded(space);
+    mtx_lock(&sharded->locks[i]);
+    void* ptr = sharded->a->Malloc(GetArena(space, i), size);
+    mtx_unlock(&sharded->locks[i]);
+    return ptr;
+}
+
+
+void InitializeSharded(const Allocator* a, void* space, BlockSize_t size, int nArenas)
+{
+    assert(nArenas >= 1 && nArenas <= MAX_ARENAS);
+    Sharded* sharded = GetSharded(space);
+    sharded->a = a;
+    sharded->nArenas = nArenas;
+    atomic_init(&sharded->nextArena, 0);
+    sharded->generation = atomic_fetch_add(&generations, 1) + 1;
+
+    // 每个子内存的大小取ALIGNMENT的整数倍，这样每个子内存的起点都是对齐的
+    BlockSize_t header = (char*)GetArena(space, 0) - (char*)space;
+    sharded->arenaSize = (size - header) / nArenas / ALIGNMENT * ALIGNMENT;
+
+    for(int i = 0; i < nArenas; i++)
+    {
+        int ok = mtx_init(&sharded->locks[i], mtx_plain);
+        assert(ok == thrd_success);
+        (void) ok;
+        a->Initialize(GetArena(space, i), sharded->arenaSize);
+    }
+}
+
+void DestroySharded(void* space)
+{
+    Sharded* sharded = GetSharded(space);
+    for(int i = 0; i < sharded->nArenas; i++)
+        mtx_destroy(&sharded->locks[i]);
+}
+
+void* ShardedMalloc(void* space, BlockSize_t size)
+{
+    Sharded* sharded = GetSharded(space);
+    int home = PickArena(space);
+    void* ptr = MallocFrom(space, home, size);
+
+    // 自己的子内存不够时，依次到别的子内存里找
+    for(int k = 1; ptr == NULL && k < sharded->nArenas; k++)
+        ptr = MallocFrom(space, (home + k) % sharded->nArenas, size);
+    return ptr;
+}
+
+void ShardedFree(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+
+    // 子内存是等大的，由地址直接算出所属的子内存
+    Sharded* sharded = GetSharded(space);
+    int i = (int)(((char*)ptr - (char*)GetArena(space, 0)) / sharded->arenaSize);
+    assert(i >= 0 && i < sharded->nArenas);
+
+    mtx_lock(&sharded->locks[i]);
+    sharded->a->Free(GetArena(space, i), ptr);
+    mtx_unlock(&sharded->locks[i]);
+}
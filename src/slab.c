@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <assert.h>
+#include "slab.h"
+
+// 请求的大小按16字节一级分组，第i组的槽位大小是(i + 1) * 16
+#define CLASS_SIZE 16
+#define CLASS_COUNT (SLAB_MAX_SIZE / CLASS_SIZE)
+
+// 放在slab开头的信息，后面是槽位
+typedef struct Slab_
+{
+    struct Slab_* prev;
+    struct Slab_* next;
+    void* free;         // 释放过的空闲槽位串成的链表
+    BlockSize_t used;   // 已分配的槽位数
+    BlockSize_t carved; // 切出来过的槽位数，之后的槽位还从来没有用过
+    int cls;
+} Slab;
+
+#define SLOTS_OFFSET ((sizeof(Slab) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT)
+
+// 放在space开头的信息，后面是页表，再后面才是交给算法管理的内存
+// 交给算法管理的内存按SLAB_SIZE分页，页表的第i项是在第i页内开始的slab，没有时为NULL
+// slab不比一页小，所以一页内最多开始一个slab
+typedef struct
+{
+    const Allocator* a;
+    Slab* partial[CLASS_COUNT]; // 每组还有空槽位的slab
+    SlabStats stats;
+    BlockSize_t pages;
+    Usage* usage;
+} Slabs;
+
+
+static Slabs* GetSlabs(void* space)
+{
+    return (Slabs*) space;
+}
+
+static Slab** GetPages(void* space)
+{
+    return (Slab**) Seek(space, sizeof(Slabs));
+}
+
+static BlockSize_t Capacity(int cls)
+{
+    return (SLAB_SIZE - SLOTS_OFFSET) / ((cls + 1) * CLASS_SIZE);
+}
+
+// 调用算法分配，需要时记录使用情况
+static void* InnerMalloc(Slabs* slabs, void* arena, BlockSize_t size)
+{
+    void* ptr = slabs->a->Malloc(arena, size);
+    if(slabs->usage)
+        TrackMalloc(slabs->usage, arena, ptr);
+    return ptr;
+}
+
+static void InnerFree(Slabs* slabs, void* arena, void* ptr)
+{
+    if(slabs->usage)
+        TrackFree(slabs->usage, arena, ptr);
+    slabs->a->Free(arena, ptr);
+}
+
+// 把slab挂到所在组的链表头部
+static void InsertSlab(Slabs* slabs, Slab* slab)
+{
+    Slab* head = slabs->partial[slab->cls];
+    slab->prev = NULL;
+    slab->next = head;
+    if(head)
+        head->prev = slab;
+    slabs->partial[slab->cls] = slab;
+}
+
+static void RemoveSlab(Slabs* slabs, Slab* slab)
+{
+    if(slab->prev)
+        slab->prev->next = slab->next;
+    else
+        slabs->partial[slab->cls] = slab->next;
+    if(slab->next)
+        slab->next->prev = slab->prev;
+}
+
+// 找到ptr所在的slab，ptr不在任何slab里时返回NULL
+// slab只可能在ptr所在的页或者前一页开始
+static Slab* FindSlab(void* space, void* ptr)
+{
+    void* arena = SlabArena(space);
+    Slab** pages = GetPages(space);
+    BlockSize_t i = ((char*)ptr - (char*)arena) / SLAB_SIZE;
+
+    Slab* slab = pages[i];
+    if(slab && (char*)slab <= (char*)ptr)
+        return slab;
+    slab = i > 0 ? pages[i - 1] : NULL;
+    if(slab && (char*)ptr < (char*)slab + SLAB_SIZE)
+        return slab;
+    return NULL;
+}
+
+// 从算法分配一个新的slab，挂到组的链表上
+static Slab* NewSlab(void* space, int cls)
+{
+    Slabs* slabs = GetSlabs(space);
+    void* arena = SlabArena(space);
+    Slab* slab = (Slab*) InnerMalloc(slabs, arena, SLAB_SIZE);
+    if(slab == NULL)
+        return NULL;
+
+    slab->free = NULL;
+    slab->used = 0;
+    slab->carved = 0;
+    slab->cls = cls;
+    GetPages(space)[((char*)slab - (char*)arena) / SLAB_SIZE] = slab;
+    InsertSlab(slabs, slab);
+    slabs->stats.slabs++;
+    return slab;
+}
+
+// 把空的slab还给算法
+static void DeleteSlab(void* space, Slab* slab)
+{
+    Slabs* slabs = GetSlabs(space);
+    void* arena = SlabArena(space);
+    RemoveSlab(slabs, slab);
+    GetPages(space)[((char*)slab - (char*)arena) / SLAB_SIZE] = NULL;
+    InnerFree(slabs, arena, slab);
+    slabs->stats.slabs--;
+}
+
+
+void* SlabArena(void* space)
+{
+    BlockSize_t header = sizeof(Slabs) + GetSlabs(space)->pages * sizeof(Slab*);
+    return Seek(space, (header + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+}
+
+void InitializeSlabs(const Allocator* a, void* space, BlockSize_t size)
+{
+    Slabs* slabs = GetSlabs(space);
+    slabs->a = a;
+    for(int i = 0; i < CLASS_COUNT; i++)
+        slabs->partial[i] = NULL;
+    slabs->stats = (SlabStats){ 0 };
+    slabs->usage = NULL;
+    // 页表按整个space估算页数，交给算法的内存只会更少
+    slabs->pages = size / SLAB_SIZE + 1;
+
+    void* arena = SlabArena(space);
+    assert(size > (char*)arena - (char*)space);
+    Slab** pages = GetPages(space);
+    for(BlockSize_t i = 0; i < slabs->pages; i++)
+        pages[i] = NULL;
+    a->Initialize(arena, size - ((char*)arena - (char*)space));
+}
+
+void* SlabMalloc(void* space, BlockSize_t size)
+{
+    Slabs* slabs = GetSlabs(space);
+    if(size > SLAB_MAX_SIZE)
+        return InnerMalloc(slabs, SlabArena(space), size);
+
+    int cls = size > 0 ? (int)((size - 1) / CLASS_SIZE) : 0;
+    Slab* slab = slabs->partial[cls];
+    if(slab == NULL && (slab = NewSlab(space, cls)) == NULL)
+        return NULL;
+
+    // 先用释放过的槽位，没有时再切一个新的
+    void* ptr = slab->free;
+    if(ptr)
+        slab->free = *(void**) ptr;
+    else
+        ptr = Seek(slab, SLOTS_OFFSET + slab->carved++ * (cls + 1) * CLASS_SIZE);
+
+    // 满了就从链表上摘下，释放出槽位时再挂回去
+    if(++slab->used == Capacity(cls))
+        RemoveSlab(slabs, slab);
+    slabs->stats.hits++;
+    slabs->stats.objects++;
+    return ptr;
+}
+
+void SlabFree(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+
+    Slabs* slabs = GetSlabs(space);
+    Slab* slab = FindSlab(space, ptr);
+    if(slab == NULL)
+    {
+        InnerFree(slabs, SlabArena(space), ptr);
+        return;
+    }
+
+    if(slab->used-- == Capacity(slab->cls))
+        InsertSlab(slabs, slab);
+    *(void**) ptr = slab->free;
+    slab->free = ptr;
+    slabs->stats.objects--;
+
+    // 空的slab还给算法，但组里唯一的slab留着
+    if(slab->used == 0 && (slab->prev || slab->next))
+        DeleteSlab(space, slab);
+}
+
+void TrackSlabs(void* space, Usage* u)
+{
+    GetSlabs(space)->usage = u;
+}
+
+SlabStats GetSlabStats(void* space)
+{
+    return GetSlabs(space)->stats;
+}
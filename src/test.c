@@ -1,76 +1,941 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
 #include "memana.h"
-#define maxn 1123456
+#include "trace.h"
+#include "usage.h"
+#include "deferred.h"
+#include "handle.h"
+#include "persist.h"
+#include "mapping.h"
+#include "histogram.h"
 #define PATH "data/input.txt"
 #define dbg(x) printf(#x " = %p\n", (x))
 #define db(x) printf(#x " = %llu\n", (x))
 
 #define BLOCK_MIN_SIZE (sizeof(Block) + sizeof(BlockSize_t))
 
+// A request that has arrived and has not finished yet. Finished requests
+// give their slot back, so only the live and waiting ones take memory.
 typedef struct
 {
-    long long s; // arrived time
-    long long t; // use time
-    long long m;  // memory needed
-    void * ptr;
+    Request req;
+    long long id; // position in the trace
+    bool allocated;
+    Handle handle; // the memory when running with handles, else req.ptr
+} Live;
 
-} Request;
+// The release of live[slot], ordered by (time, id).
+// Every live request has at most one pending event at a time.
+typedef struct
+{
+    long long time;
+    long long id;
+    int slot;
+} Event;
+
+
+Live* live;
+int nLive, liveCap;
+// slots of finished requests, reused before live[] grows
+int* freeSlots;
+int nFreeSlots;
+
+// min-heap of events ordered by (time, id)
+Event* events;
+int nEvents, eventsCap;
+
+// slots of the requests waiting for memory, in ascending id order
+int* waiting;
+
+// time spent reading the trace during the last run
+long long readNs;
+
+// arrivals read ahead from the trace, so the reader is timed once per chunk
+// instead of once per request
+#define READ_AHEAD 4096
+Request ahead[READ_AHEAD];
+int nAhead, nTaken;
+
+// the requests of the current batch; no more than the live ones, so these
+// grow with live[] too
+int* batchSlots;
+BlockSize_t* batchSizes;
+void** batchPtrs;
+
+// options
+const char* tracePath = PATH;
+FILE* csv;               // usage samples go here when set
+long long sampleEvery = 1000; // Malloc/Free calls between two samples
+bool deferred;           // run the strategies under deferred coalescing
+long long compactEvery;  // run with handles, compacting at most this often
+                         // (in simulated seconds) when that lets a request in
+const char* persistPath; // map the memory from this file instead
+bool batch;              // allocate the arrivals and free the releases of
+                         // each second with one call each
+bool mapped;             // map the memory with mmap, see mapping.h
+int mapFlags;            // how, with -b
+long long releaseEvery;  // give the pages inside large free blocks back this
+                         // often (in simulated seconds) when mapped
+
+// handles in use at the same time, when running with handles
+#define MAX_HANDLES (1 << 20)
+long long lastCompact;
+long long compactions;
+BlockSize_t compactedBytes;
+
+// free blocks at least this large have their pages given back
+#define RELEASE_MIN_SIZE (64 << 10)
+long long lastRelease;
+BlockSize_t releasedBytes;
+BlockSize_t residentPeak;
+
+Usage usage;
+long long ops; // successful Malloc/Free calls of the current run
+
+#ifdef MEMANA_STATS
+// successful calls, tries that found no room, and compaction passes
+Histogram mallocNs, freeNs, failedNs, compactNs;
+
+// h is taken after the call, so it can depend on how the call went
+#define TIMED(h, call) do { long long begin = Now(); call; Record(h, Now() - begin); } while(0)
+// a call for n requests counts as n calls taking the average time; k of
+// them, taken after the call, go to h and the rest to failedNs
+#define TIMED_BATCH(h, n, k, call) do { long long begin = Now(); call; \
+    long long each = (Now() - begin) / ((n) > 0 ? (n) : 1); \
+    for(int i_ = 0; i_ < (n); i_++) Record(i_ < (k) ? (h) : &failedNs, each); } while(0)
+#else
+#define TIMED(h, call) call
+#define TIMED_BATCH(h, n, k, call) call
+#endif
+
+
+static long long Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Makes room for need elements in a growable array.
+static void Reserve(void* p, int* cap, int need, size_t size)
+{
+    if(need <= *cap)
+        return;
+    int newCap = *cap ? *cap : 1024;
+    while(newCap < need)
+        newCap *= 2;
+    *(void**)p = realloc(*(void**)p, (size_t)newCap * size);
+    assert(*(void**)p != NULL);
+    *cap = newCap;
+}
+
+#ifdef MEMANA_STATS
+static void PrintHistogram(const char* name, const Histogram* h)
+{
+    printf("\t%s\tcount: %lld\tmean: %.0f ns", name, h->n, Mean(h));
+    printf("\tp50/p99/p99.9/max: %lld/%lld/%lld/%lld ns\n", Percentile(h, 50),
+           Percentile(h, 99), Percentile(h, 99.9), h->max);
+}
+
+// Prints the latencies and the work the allocator has done since the
+// previous call.
+static void PrintStats(void)
+{
+    long long calls = mallocNs.n + freeNs.n;
+    PrintHistogram("malloc", &mallocNs);
+    PrintHistogram("free", &freeNs);
+    if(failedNs.n > 0)
+        PrintHistogram("failed", &failedNs);
+    if(compactNs.n > 0)
+        PrintHistogram("compact", &compactNs);
+    // the searches of failed tries are part of the cost of the calls that succeed
+    printf("\tvisited: %.2f per call\tsplits: %llu\tmerges: %llu\n",
+           calls ? (double) memanaStats.visited / calls : 0.0, memanaStats.splits, memanaStats.merges);
+    memset(&mallocNs, 0, sizeof(Histogram));
+    memset(&freeNs, 0, sizeof(Histogram));
+    memset(&failedNs, 0, sizeof(Histogram));
+    memset(&compactNs, 0, sizeof(Histogram));
+    memset(&memanaStats, 0, sizeof(Stats));
+}
+#endif
+
+static bool EventLess(const Event* a, const Event* b)
+{
+    return a->time < b->time || (a->time == b->time && a->id < b->id);
+}
+
+static void SiftDown(int i)
+{
+    Event e = events[i];
+    for(;;)
+    {
+        int child = 2 * i + 1;
+        if(child >= nEvents)
+            break;
+        if(child + 1 < nEvents && EventLess(&events[child + 1], &events[child]))
+            child++;
+        if(!EventLess(&events[child], &e))
+            break;
+        events[i] = events[child];
+        i = child;
+    }
+    events[i] = e;
+}
+
+static void PushEvent(long long time, int slot)
+{
+    Reserve(&events, &eventsCap, nEvents + 1, sizeof(Event));
+    Event e = { time, live[slot].id, slot };
+    int i = nEvents++;
+    while(i > 0 && EventLess(&e, &events[(i - 1) / 2]))
+    {
+        events[i] = events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    events[i] = e;
+}
+
+static Event PopEvent(void)
+{
+    Event top = events[0];
+    events[0] = events[--nEvents];
+    SiftDown(0);
+    return top;
+}
+
+// the memory the strategy itself manages
+static void* Arena(void* space)
+{
+    if(deferred)
+        return DeferredArena(space);
+    if(compactEvery > 0)
+        return HandleArena(space);
+    return space;
+}
+
+static void Sample(const Allocator* a, void* space, long long t)
+{
+    space = Arena(space);
+    RefreshUsage(&usage, space);
+    fprintf(csv, "%s,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%.4f,%lld\n", a->name, ops, t,
+            usage.usedBytes, usage.usedBlocks, usage.freeBytes, usage.freeBlocks,
+            UsageLargest(&usage, a, space), UsageFragmentation(&usage, a, space), usage.headerBytes);
+}
 
-Request requests[maxn];
+// Gives the pages inside the large free blocks back to the system when it
+// is time to, and remembers the most memory that was resident before.
+static void Sweep(const Allocator* a, void* space, BlockSize_t size, long long t)
+{
+    if(releaseEvery == 0 || t < lastRelease + releaseEvery)
+        return;
+    BlockSize_t resident = ResidentBytes(space, size);
+    if(resident > residentPeak)
+        residentPeak = resident;
+    // pages given back before and not touched since are given back again, so
+    // count what actually left memory
+    ReleaseFreePages(a, Arena(space), RELEASE_MIN_SIZE, mapFlags);
+    releasedBytes += resident - ResidentBytes(space, size);
+    lastRelease = t;
+}
+
+// Keeps the usage up to date while a CSV is written; ptr has just been
+// allocated, or is about to be freed. The deferred and handle layers track
+// the calls they pass on to the strategy by themselves.
+static void Track(void* space, void* ptr, bool allocated)
+{
+    if(csv == NULL || deferred || compactEvery > 0)
+        return;
+    if(allocated)
+        TrackMalloc(&usage, space, ptr);
+    else
+        TrackFree(&usage, space, ptr);
+}
+
+// Counts n Malloc/Free calls once they are done, so a sample never falls
+// between TrackFree and the free itself.
+static void CountCalls(const Allocator* a, void* space, long long t, int n)
+{
+    if(csv == NULL)
+        return;
+    for(int i = 0; i < n; i++)
+        if(++ops % sampleEvery == 0)
+            Sample(a, space, t);
+}
+
+// Allocates the memory of l with the strategy, or with the layer on top of
+// it; returns false when there is no room.
+static bool Allocate(const Allocator* a, void* space, Live* l)
+{
+    Request* req = &l->req;
+    if(deferred)
+        req->ptr = DeferredMalloc(space, req->m);
+    else if(compactEvery > 0)
+    {
+        if(a->Largest == NULL || a->Largest(HandleArena(space)) >= req->m)
+            l->handle = HandleMalloc(space, req->m);
+        return l->handle != NO_HANDLE;
+    }
+    // skip the search when the largest free block is known to be too small
+    else if(a->Largest == NULL || a->Largest(space) >= req->m)
+        req->ptr = a->Malloc(space, req->m);
+    return req->ptr != NULL;
+}
+
+// Allocate, timed apart from the tries that find no room.
+static bool TimedAllocate(const Allocator* a, void* space, Live* l)
+{
+    bool allocated;
+    TIMED(allocated ? &mallocNs : &failedNs, allocated = Allocate(a, space, l));
+    return allocated;
+}
+
+// With handles, gathers the free space into one block when it is time to
+// and that makes room for l; returns true when it did.
+static bool CompactFor(void* space, const Live* l, long long t)
+{
+    if(compactEvery == 0 || t < lastCompact + compactEvery
+        || CompactableSpace(space) < l->req.m + ALIGNMENT)
+        return false;
+    TIMED(&compactNs, compactedBytes += Compact(space));
+    compactions++;
+    lastCompact = t;
+    return true;
+}
+
+static void Release(const Allocator* a, void* space, Live* l)
+{
+    if(deferred)
+        DeferredFree(space, l->req.ptr, l->req.m);
+    else if(compactEvery > 0)
+        HandleFree(space, l->handle);
+    else
+        a->Free(space, l->req.ptr);
+}
+
+// The largest free block the release of ptr can make: the block merged with
+// its free neighbours. Only known when the strategy merges its own blocks at
+// once, with nothing on top; otherwise anything may fit afterwards.
+static BlockSize_t Freeing(const Allocator* a, void* space, void* ptr)
+{
+    if(deferred || compactEvery > 0 || a->lazyMerge || a->Walk)
+        return LLONG_MAX;
+    Block* p = SeekBlockFromData(ptr);
+    BlockSize_t size = -p->size;
+    Block* prev = SeekPrevBlock(space, p);
+    Block* next = SeekNextBlock(space, p);
+    if(prev)
+        size += 2 * sizeof(BlockSize_t) + prev->size;
+    if(next)
+        size += 2 * sizeof(BlockSize_t) + next->size;
+    return size;
+}
 
+static int NewSlot(const Request* req, long long id)
+{
+    int slot;
+    if(nFreeSlots > 0)
+        slot = freeSlots[--nFreeSlots];
+    else
+    {
+        // free and waiting slots are live slots too, so they grow together
+        int cap = liveCap;
+        Reserve(&live, &liveCap, nLive + 1, sizeof(Live));
+        if(liveCap != cap)
+        {
+            freeSlots = realloc(freeSlots, liveCap * sizeof(int));
+            waiting = realloc(waiting, liveCap * sizeof(int));
+            assert(freeSlots != NULL && waiting != NULL);
+            batchSlots = realloc(batchSlots, liveCap * sizeof(int));
+            batchSizes = realloc(batchSizes, liveCap * sizeof(BlockSize_t));
+            batchPtrs = realloc(batchPtrs, liveCap * sizeof(void*));
+            assert(batchSlots != NULL && batchSizes != NULL && batchPtrs != NULL);
+        }
+        slot = nLive++;
+    }
+    live[slot] = (Live){ *req, id, false, NO_HANDLE };
+    return slot;
+}
 
-int main(void)
+static void ReleaseSlot(int slot)
 {
-    puts("Reading the input file.");
-    long long n, L;
-    FILE* input = fopen(PATH, "r");
-    // printf("errno: %d", errno);
-    assert(input != NULL);
-    //FILE* input = stdin;
-    fscanf(input, "%lld %lld", &n, &L);
+    freeSlots[nFreeSlots++] = slot;
+}
 
-    void * space = malloc(L * sizeof(char));
-    assert(space != NULL);
+// Frees the memory of the n requests in batchSlots, batchPtrs, with one call.
+// Returns the largest free block this can make, at most all of them merged.
+static BlockSize_t ReleaseBatch(const Allocator* a, void* space, long long t, int n)
+{
+    BlockSize_t grown = 0;
+    for(int i = 0; i < n && grown < LLONG_MAX; i++)
+    {
+        BlockSize_t size = Freeing(a, space, batchPtrs[i]);
+        if(size < LLONG_MAX)
+            size += 2 * sizeof(BlockSize_t);
+        grown = size < LLONG_MAX - grown ? grown + size : LLONG_MAX;
+    }
+    TIMED_BATCH(&freeNs, n, n, FreeBatch(a, space, batchPtrs, n, csv ? TrackBatch : NULL, &usage));
+    CountCalls(a, space, t, n);
+    for(int i = 0; i < n; i++)
+        ReleaseSlot(batchSlots[i]);
+    return grown;
+}
 
-    Initialize(space,  L * sizeof(char));
+// Frees the memory of every request that finishes at t, see ReleaseBatch.
+static BlockSize_t ReleaseEvents(const Allocator* a, void* space, long long t)
+{
+    int n = 0;
+    while(nEvents > 0 && events[0].time == t)
+    {
+        int slot = PopEvent().slot;
+        batchSlots[n] = slot;
+        batchPtrs[n++] = live[slot].req.ptr;
+    }
+    return ReleaseBatch(a, space, t, n);
+}
+
+// Allocates the memory of the n arrivals in batchSlots with one call. The
+// ones that get no memory are put at the end of rest, and the ones that
+// finish at once are freed with another call. Returns the length of rest,
+// and sets *grown as ReleaseBatch returns when something was freed.
+static int AllocateBatch(const Allocator* a, void* space, long long t, int n, int* rest, int nRest, BlockSize_t* grown)
+{
+    for(int i = 0; i < n; i++)
+        batchSizes[i] = live[batchSlots[i]].req.m;
+    int k;
+    TIMED_BATCH(&mallocNs, n, k, k = MallocBatch(a, space, batchSizes, n, batchPtrs, csv ? TrackBatch : NULL, &usage));
+    CountCalls(a, space, t, k);
 
-    long long tot = 0;
+    int nDone = 0;
     for(int i = 0; i < n; i++)
     {
-        Request * req = &requests[i];
-        fscanf(input, "%lld %lld %lld", &req->s, &req->t, &req->m);
-        req->ptr = NULL;
-        tot += req->m;
-    }
-    unsigned long long t = 0;
-    bool finished = false;
-    puts("Reading done.\nStart solving.");
-    while(!finished)
-    {
-        finished = true;
-        for(int i = 0; i < n; i++)
-        {
-            Request * req = &requests[i];
-            if(req->m == 0) continue; // finished
-            finished = false;
-            if(req->ptr == NULL && t >= req->s){
-                req->s = t;
-                req->ptr = Malloc(space, req->m);
+        int slot = batchSlots[i];
+        Live* l = &live[slot];
+        l->req.ptr = batchPtrs[i];
+        l->allocated = l->req.ptr != NULL;
+        if(!l->allocated)
+            rest[nRest++] = slot;
+        else if(l->req.t > 0)
+            PushEvent(t + l->req.t, slot);
+        else
+        {
+            batchSlots[nDone] = slot;
+            batchPtrs[nDone++] = l->req.ptr;
+        }
+    }
+    if(nDone > 0)
+        *grown = ReleaseBatch(a, space, t, nDone);
+    return nRest;
+}
+
+// Returns the position of the first waiting request in waiting[begin..end)
+// whose id is larger than id.
+static int FirstAfter(int begin, int end, long long id)
+{
+    while(begin < end)
+    {
+        int mid = begin + (end - begin) / 2;
+        if(live[waiting[mid]].id < id)
+            begin = mid + 1;
+        else
+            end = mid;
+    }
+    return begin;
+}
+
+// Reads the next arrival; returns false after the last one.
+static bool ReadArrival(TraceReader* reader, Request* req)
+{
+    if(nTaken == nAhead)
+    {
+        long long prev = nAhead > 0 ? ahead[nAhead - 1].s : 0;
+        long long begin = Now();
+        int r = 0;
+        nAhead = nTaken = 0;
+        while(nAhead < READ_AHEAD && (r = ReadRequest(reader, &ahead[nAhead])) > 0)
+        {
+            if(ahead[nAhead].s < prev)
+            {
+                fprintf(stderr, "request %lld arrives before the previous one\n", reader->read - 1);
+                exit(1);
+            }
+            prev = ahead[nAhead++].s;
+        }
+        readNs += Now() - begin;
+        if(r < 0)
+        {
+            fprintf(stderr, "malformed trace at request %lld\n", reader->read);
+            exit(1);
+        }
+    }
+    if(nTaken == nAhead)
+        return false;
+    *req = ahead[nTaken++];
+    return true;
+}
+
+// Requests are handled in id order within a second, exactly like scanning
+// the whole trace once per second. A request that arrives and finds no
+// memory waits until some memory is freed, so the clock jumps from one
+// event to the next instead of ticking through the idle seconds.
+// Arrivals are read from the trace as the clock reaches them; they come
+// after every request read before, so they are handled after the waiting
+// requests and the releases of the same second.
+// A waiting request gets another try only when a block large enough for it
+// has been freed since its last one; until then it would fail again, so it
+// is left in the queue untried.
+// With batches, the releases that come after the last waiting request, and
+// then the arrivals, each go to the strategy in one call.
+static unsigned long long Simulate(const Allocator* a, void* space, BlockSize_t size, TraceReader* reader)
+{
+    nEvents = nLive = nFreeSlots = 0;
+    readNs = 0;
+    nAhead = nTaken = 0;
+    Request next;
+    bool more = ReadArrival(reader, &next);
+    long long nextId = 0;
+
+    // waiting[j..nQueue) is the queue, the requests still waiting are
+    // collected in place in waiting[0..nRest)
+    int nQueue = 0;
+    int stale = 0;         // the first stale requests in the queue were tried
+                           // before the last free
+    BlockSize_t staleGrown = 0; // the largest block freed since they were tried
+    BlockSize_t fails = LLONG_MAX; // requests this large fail until the next free
+    long long t = 0;
+    long long retry = -1;  // the stale requests get another try at this time
+    long long walked = -1; // the last time the queue was tried
+    long long last = -1;   // time of the last free
+
+    while(nEvents > 0 || retry >= 0 || more)
+    {
+        t = LLONG_MAX;
+        if(nEvents > 0)
+            t = events[0].time;
+        if(retry >= 0 && retry < t)
+            t = retry;
+        if(more && next.s < t)
+            t = next.s;
+        // with handles, the whole queue is tried once compaction is allowed again
+        if(compactEvery > 0 && walked < lastCompact + compactEvery && t >= lastCompact + compactEvery)
+        {
+            stale = nQueue;
+            staleGrown = LLONG_MAX;
+        }
+        retry = -1;
+
+        int nRest = 0;
+        int j = 0;
+        bool freed = false;
+        BlockSize_t grown = 0; // the largest block freed at t so far
+        int nStale = 0;        // nRest at the last free
+        for(;;)
+        {
+            int slot;
+            bool event = nEvents > 0 && events[0].time == t;
+            if(event && (j == nQueue || events[0].id < live[waiting[j]].id))
+            {
+                if(batch && j == nQueue)
+                {
+                    BlockSize_t size = ReleaseEvents(a, space, t);
+                    grown = size > grown ? size : grown;
+                    fails = LLONG_MAX;
+                    freed = true;
+                    nStale = nRest;
+                    last = t;
+                    continue;
+                }
+                slot = PopEvent().slot;
+            }
+            else if(j < nQueue && j >= stale && !freed)
+            {
+                // nothing has been freed since these were tried, so the
+                // requests before the next release stay waiting, untried
+                int end = event ? FirstAfter(j, nQueue, events[0].id) : nQueue;
+                if(nRest < j)
+                    memmove(&waiting[nRest], &waiting[j], (end - j) * sizeof(int));
+                nRest += end - j;
+                j = end;
+                continue;
+            }
+            else if(j < nQueue)
+            {
+                slot = waiting[j++];
+                // a request can only get in when a large enough block has
+                // been freed since it was tried, and no smaller request has
+                // failed after that
+                BlockSize_t room = grown;
+                if(j <= stale && staleGrown > room)
+                    room = staleGrown;
+                if(fails <= room)
+                    room = fails - 1;
+                if(live[slot].req.m > room)
+                {
+                    waiting[nRest++] = slot;
+                    continue;
+                }
+                walked = t;
             }
-            if(req->ptr != NULL && t >= req->s + req->t){
-                Free(space, req->ptr), req->m = 0;
+            else if(more && next.s == t)
+            {
+                if(batch)
+                {
+                    int n = 0;
+                    while(more && next.s == t)
+                    {
+                        // NewSlot may move batchSlots
+                        slot = NewSlot(&next, nextId++);
+                        batchSlots[n++] = slot;
+                        more = ReadArrival(reader, &next);
+                    }
+                    BlockSize_t size = 0;
+                    nRest = AllocateBatch(a, space, t, n, waiting, nRest, &size);
+                    if(size > 0)
+                    {
+                        grown = size > grown ? size : grown;
+                        fails = LLONG_MAX;
+                        freed = true;
+                        nStale = nRest;
+                        last = t;
+                    }
+                    continue;
+                }
+                slot = NewSlot(&next, nextId++);
+                more = ReadArrival(reader, &next);
+                if(live[slot].req.m >= fails)
+                {
+                    waiting[nRest++] = slot;
+                    continue;
+                }
             }
+            else
+                break;
+
+            Live * l = &live[slot];
+            Request * req = &l->req;
+            if(!l->allocated)
+            {
+                l->allocated = TimedAllocate(a, space, l);
+                if(!l->allocated && CompactFor(space, l, t))
+                    l->allocated = TimedAllocate(a, space, l);
+                if(!l->allocated)
+                {
+                    // a strategy with nothing on top fails on every larger
+                    // request too; the quick lists and compaction may not
+                    if(!deferred && compactEvery == 0 && req->m < fails)
+                        fails = req->m;
+                    waiting[nRest++] = slot;
+                    continue;
+                }
+                Track(space, req->ptr, true);
+                CountCalls(a, space, t, 1);
+                if(req->t > 0)
+                {
+                    PushEvent(t + req->t, slot);
+                    continue;
+                }
+            }
+            BlockSize_t size = Freeing(a, space, req->ptr);
+            grown = size > grown ? size : grown;
+            fails = LLONG_MAX;
+            Track(space, req->ptr, false);
+            TIMED(&freeNs, Release(a, space, l));
+            CountCalls(a, space, t, 1);
+            ReleaseSlot(slot);
+            freed = true;
+            nStale = nRest;
+            last = t;
         }
-        t++;
+
+        nQueue = nRest;
+        stale = nStale;
+        staleGrown = grown;
+        if(stale > 0)
+            retry = t + 1;
+        if(mapped)
+            Sweep(a, space, size, t);
     }
-    t--;
-    printf("time: %llu\n", t);
 
-    return 0;
+    if(nQueue > 0)
+        printf("%d requests can never be satisfied.\n", nQueue);
+
+    // the first second at which every request has finished
+    return last + 1;
 }
 
 
+// Takes the options out of the arguments:
+//   -f trace   the trace to replay, text or binary
+//   -c file    write a CSV time series of the memory usage to file
+//   -e n       sample the usage every n Malloc/Free calls
+//   -d         defer coalescing, see deferred.h
+//   -m n       allocate handles and compact at most every n seconds, see handle.h
+//   -p file    map the memory from file, then reopen it after the run, see persist.h
+//   -g         allocate and free the requests of each second in batches
+//   -b kind    map the memory with mmap: pages, thp or hugetlb, see mapping.h
+//   -r n       with -b, give the pages of large free blocks back every n seconds
+static void ParseOptions(int* argc, char** argv)
+{
+    int k = 1;
+    for(int i = 1; i < *argc; i++)
+    {
+        bool value = i + 1 < *argc;
+        if(strcmp(argv[i], "-f") == 0 && value)
+            tracePath = argv[++i];
+        else if(strcmp(argv[i], "-c") == 0 && value)
+        {
+            csv = fopen(argv[++i], "w");
+            if(csv == NULL)
+            {
+                perror(argv[i]);
+                exit(1);
+            }
+            fprintf(csv, "strategy,calls,time,used_bytes,used_blocks,free_bytes,free_blocks,"
+                         "largest_free,fragmentation,header_bytes\n");
+        }
+        else if(strcmp(argv[i], "-d") == 0)
+            deferred = true;
+        else if(strcmp(argv[i], "-m") == 0 && value && atoll(argv[i + 1]) > 0)
+            compactEvery = atoll(argv[++i]);
+        else if(strcmp(argv[i], "-p") == 0 && value)
+            persistPath = argv[++i];
+        else if(strcmp(argv[i], "-g") == 0)
+            batch = true;
+        else if(strcmp(argv[i], "-b") == 0 && value && strcmp(argv[i + 1], "pages") == 0)
+            mapped = true, mapFlags = 0, i++;
+        else if(strcmp(argv[i], "-b") == 0 && value && strcmp(argv[i + 1], "thp") == 0)
+            mapped = true, mapFlags = MAPPING_THP, i++;
+        else if(strcmp(argv[i], "-b") == 0 && value && strcmp(argv[i + 1], "hugetlb") == 0)
+            mapped = true, mapFlags = MAPPING_HUGETLB, i++;
+        else if(strcmp(argv[i], "-r") == 0 && value && atoll(argv[i + 1]) > 0)
+            releaseEvery = atoll(argv[++i]);
+        else if(strcmp(argv[i], "-e") == 0 && value && atoll(argv[i + 1]) > 0)
+            sampleEvery = atoll(argv[++i]);
+        else
+            argv[k++] = argv[i];
+    }
+    *argc = k;
+    if(deferred + (compactEvery > 0) + (persistPath != NULL) > 1)
+    {
+        fprintf(stderr, "-d, -m and -p cannot be used together\n");
+        exit(1);
+    }
+    if(batch && (deferred || compactEvery > 0))
+    {
+        fprintf(stderr, "-g cannot be used with -d or -m\n");
+        exit(1);
+    }
+    if(mapped && persistPath)
+    {
+        fprintf(stderr, "-b and -p cannot be used together\n");
+        exit(1);
+    }
+    if(releaseEvery > 0 && !mapped)
+    {
+        fprintf(stderr, "-r needs -b\n");
+        exit(1);
+    }
+}
+
+// Strategies to run: the ones named on the command line, otherwise the one
+// the program is named after (first, next, ...), otherwise all of them.
+static int SelectAllocators(int argc, char** argv, const Allocator** selected)
+{
+    int k = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        const Allocator* a = FindAllocator(argv[i]);
+        if(a == NULL)
+        {
+            fprintf(stderr, "unknown strategy: %s\n", argv[i]);
+            exit(1);
+        }
+        selected[k++] = a;
+    }
+    if(k > 0)
+        return k;
+
+    const char* name = strrchr(argv[0], '/');
+    name = name ? name + 1 : argv[0];
+    const Allocator* a = FindAllocator(name);
+    if(a)
+    {
+        selected[k++] = a;
+        return k;
+    }
+
+    while(allocators[k])
+        selected[k] = allocators[k], k++;
+    return k;
+}
+
+
+int main(int argc, char** argv)
+{
+    int nAllocators = 0;
+    while(allocators[nAllocators])
+        nAllocators++;
+    ParseOptions(&argc, argv);
+    const char* path = tracePath;
+    const Allocator* selected[argc + nAllocators];
+    int nSelected = SelectAllocators(argc, argv, selected);
+
+    // the header tells the size of the memory
+    TraceReader reader;
+    if(OpenTrace(path, &reader) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+    long long L = reader.L;
+    printf("%s: %lld requests, %.1f MB\n", path, reader.n, reader.bytes / 1e6);
+    CloseTrace(&reader);
+
+    void * space = NULL;
+    if(persistPath == NULL && !mapped)
+    {
+        space = malloc(L * sizeof(char));
+        assert(space != NULL);
+    }
+
+    for(int k = 0; k < nSelected; k++)
+    {
+        const Allocator* a = selected[k];
+        if(compactEvery > 0 && (a->lazyMerge || a->Walk))
+        {
+            printf("%s\tskipped: compaction needs plain blocks merged on Free\n", a->name);
+            continue;
+        }
+        if(deferred && (a->lazyMerge || a->Walk))
+        {
+            printf("%s\tskipped: deferred coalescing needs plain blocks merged on Free\n", a->name);
+            continue;
+        }
+        if(persistPath && !a->relocatable)
+        {
+            printf("%s\tskipped: a mapped file needs a relocatable strategy\n", a->name);
+            continue;
+        }
+        // every run maps fresh memory, so it starts with nothing resident
+        if(mapped)
+        {
+            space = MapArena(L * sizeof(char), mapFlags);
+            if(space == NULL)
+            {
+                perror("mmap");
+                return 1;
+            }
+            lastRelease = 0;
+            releasedBytes = residentPeak = 0;
+        }
+        // the memory the run allocates from, under the header of the file when mapped
+        void* run = space;
+        if(deferred)
+        {
+            InitializeDeferred(a, space, L * sizeof(char));
+            InitializeUsage(&usage, a, DeferredArena(space));
+            if(csv)
+                TrackDeferred(space, &usage);
+        }
+        else if(compactEvery > 0)
+        {
+            InitializeHandles(a, space, L * sizeof(char), MAX_HANDLES);
+            InitializeUsage(&usage, a, HandleArena(space));
+            if(csv)
+                TrackHandles(space, &usage);
+            lastCompact = -compactEvery;
+            compactions = compactedBytes = 0;
+        }
+        else if(persistPath)
+        {
+            space = CreateArenaFile(persistPath, a, L * sizeof(char));
+            if(space == NULL)
+            {
+                perror(persistPath);
+                return 1;
+            }
+            run = PersistentArena(space);
+            InitializeUsage(&usage, a, run);
+        }
+        else
+        {
+            a->Initialize(space, L * sizeof(char));
+            InitializeUsage(&usage, a, space);
+        }
+        ops = 0;
+
+        // every run reads the trace again, so it never has to fit in memory
+        if(OpenTrace(path, &reader) < 0)
+        {
+            perror(path);
+            return 1;
+        }
+        clock_t begin = clock();
+        unsigned long long t = Simulate(a, run, L * sizeof(char), &reader);
+        clock_t end = clock();
+        double seconds = readNs * 1e-9;
+        printf("%s\ttime: %llu\tcost: %.3f s", a->name, t, (double)(end - begin) / CLOCKS_PER_SEC);
+        printf("\tread: %.1f MB/s", reader.bytes / 1e6 / (seconds > 0 ? seconds : 1e-9));
+        if(deferred)
+        {
+            DeferredStats stats = GetDeferredStats(space);
+            printf("\tquick hits: %llu\tflushes: %llu", stats.hits, stats.flushes);
+            FlushDeferred(space);
+        }
+        if(compactEvery > 0)
+            printf("\tcompactions: %lld\tmoved: %.1f MB", compactions, compactedBytes / 1e6);
+        if(csv)
+            Sample(a, run, t);
+        if(persistPath)
+        {
+            // a warm restart: map the file again and take up the memory as it is
+            CloseArenaFile(space);
+            const Allocator* attached;
+            long long t0 = Now();
+            space = OpenArenaFile(persistPath, &attached);
+            long long t1 = Now();
+            if(space == NULL || attached != a)
+            {
+                perror(persistPath);
+                return 1;
+            }
+            printf("\tattach: %.3f ms", (t1 - t0) * 1e-6);
+            CloseArenaFile(space);
+            space = NULL;
+        }
+        if(mapped)
+        {
+            BlockSize_t resident = ResidentBytes(space, L * sizeof(char));
+            if(resident > residentPeak)
+                residentPeak = resident;
+            printf("\tresident: %.1f MB (peak %.1f MB)", resident / 1e6, residentPeak / 1e6);
+            if(releaseEvery > 0)
+                printf("\treleased: %.1f MB", releasedBytes / 1e6);
+            UnmapArena(space, L * sizeof(char), mapFlags);
+            space = NULL;
+        }
+        printf("\n");
+        CloseTrace(&reader);
+#ifdef MEMANA_STATS
+        PrintStats();
+#endif
+    }
+
+    if(csv)
+        fclose(csv);
+    free(space);
+    free(live);
+    free(freeSlots);
+    free(events);
+    free(waiting);
+    free(batchSlots);
+    free(batchSizes);
+    free(batchPtrs);
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <assert.h>
+#include "memana.h"
+
+#define dp(p) printf(#p " = %p\n", (p))
+#define dd(d) printf(#d " = %I64d\n", (d))
+#define ABS(size) ((size) >= 0 ? (size) : -(size))
+#define PREV(pBlock) ((pBlock)->node.prev)
+#define NEXT(pBlock) ((pBlock)->node.next)
+#define BLOCK_MIN_SIZE (sizeof(Block) + sizeof(BlockSize_t))
+
+// 两级分组适应(TLSF, Two-Level Segregated Fit)
+// 第一级按大小的最高位分组，第二级再把每个第一级的组等分成SL_COUNT份。
+// 两级都用位图记录哪些组不为空，分配和释放都只需要几次位运算，
+// 不遍历任何链表，所以最坏情况下的耗时也是O(1)。
+#define SL_BITS 5
+#define SL_COUNT (1 << SL_BITS)
+#define FL_COUNT 64
+
+// 保存在内存头部之后的两级分组信息
+typedef struct
+{
+    unsigned long long flBitmap;
+    unsigned int slBitmap[FL_COUNT];
+    Block* blocks[FL_COUNT][SL_COUNT];
+} Control;
+
+
+static Control* GetControl(void* space)
+{
+    return (Control*) GetExtraSpace(space);
+}
+
+static int Log2(unsigned long long x)
+{
+    return 63 - __builtin_clzll(x);
+}
+
+// 计算大小为size的块所属的组
+// 小于SL_COUNT的块都放在第0组，按大小直接分到第二级
+static void Mapping(BlockSize_t size, int* fl, int* sl)
+{
+    if(size < SL_COUNT)
+    {
+        *fl = 0;
+        *sl = (int) size;
+        return;
+    }
+    int log = Log2(size);
+    *fl = log - SL_BITS + 1;
+    *sl = (int)(size >> (log - SL_BITS)) - SL_COUNT;
+}
+
+// 计算分配size时要从哪个组开始找
+// 把size向上取整到下一个第二级组的下界，这样那个组里的任何块都放得下
+static void MappingSearch(BlockSize_t size, int* fl, int* sl)
+{
+    if(size >= SL_COUNT)
+        size += (1LL << (Log2(size) - SL_BITS)) - 1;
+    Mapping(size, fl, sl);
+}
+
+// 将空闲块挂到它所属组的链表头部
+static void InsertBlock(void* space, Block* curr)
+{
+    Control* control = GetControl(space);
+    int fl, sl;
+    Mapping(curr->size, &fl, &sl);
+
+    Block* head = control->blocks[fl][sl];
+    PREV(curr) = NULL;
+    NEXT(curr) = head;
+    if(head)
+        PREV(head) = curr;
+    control->blocks[fl][sl] = curr;
+
+    control->flBitmap |= 1ULL << fl;
+    control->slBitmap[fl] |= 1U << sl;
+}
+
+// 将空闲块从它所属组的链表中摘下，组变空时清掉两级位图中对应的位
+static void RemoveBlock(void* space, Block* curr)
+{
+    Control* control = GetControl(space);
+    int fl, sl;
+    Mapping(curr->size, &fl, &sl);
+
+    if(PREV(curr))
+        NEXT(PREV(curr)) = NEXT(curr);
+    else
+        control->blocks[fl][sl] = NEXT(curr);
+    if(NEXT(curr))
+        PREV(NEXT(curr)) = PREV(curr);
+
+    if(control->blocks[fl][sl] == NULL)
+    {
+        control->slBitmap[fl] &= ~(1U << sl);
+        if(control->slBitmap[fl] == 0)
+            control->flBitmap &= ~(1ULL << fl);
+    }
+}
+
+// 找一个放得下size的空闲块，找不到时返回NULL
+static Block* FindBlock(void* space, BlockSize_t size)
+{
+    Control* control = GetControl(space);
+    int fl, sl;
+    MappingSearch(size, &fl, &sl);
+    if(fl >= FL_COUNT)
+        return NULL;
+
+    // 先在同一个第一级组里找不小于sl的第二级组
+    unsigned int slMap = control->slBitmap[fl] & (~0U << sl);
+    if(slMap == 0)
+    {
+        // 再找更大的第一级组，其中最小的第二级组就可以
+        unsigned long long flMap = fl + 1 < FL_COUNT ? control->flBitmap & (~0ULL << (fl + 1)) : 0;
+        if(flMap == 0)
+            return NULL;
+        fl = __builtin_ctzll(flMap);
+        slMap = control->slBitmap[fl];
+    }
+    sl = __builtin_ctz(slMap);
+    return control->blocks[fl][sl];
+}
+
+
+// 初始化内存，在内存头部之后保存两级分组信息
+static void Initialize(void* space, BlockSize_t size)
+{
+    Control* control = GetControl(space);
+    Block* pBlock = InitializeSpace(space, size, sizeof(Control));
+
+    control->flBitmap = 0;
+    for(int i = 0; i < FL_COUNT; i++)
+    {
+        control->slBitmap[i] = 0;
+        for(int j = 0; j < SL_COUNT; j++)
+            control->blocks[i][j] = NULL;
+    }
+    InsertBlock(space, pBlock);
+}
+
+
+static void* Malloc(void* space, BlockSize_t size)
+{
+    // 按对齐要求取整，块被释放后也要放得下链表节点
+    size = AlignSize(size);
+
+    Block* p = FindBlock(space, size);
+    if(p == NULL)
+        return NULL;
+
+    // 把块从组中摘下，多余的部分拆成一个新的空闲块挂回对应的组
+    RemoveBlock(space, p);
+    Block* rest = SplitBlock(p, size);
+    if(rest)
+        InsertBlock(space, rest);
+
+    SetBlockUsed(p);
+    return (void*) p->data;
+}
+
+static void Free(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+
+    // 找到分配出去的这个块，并设置为未使用
+    Block* curr = SeekBlockFromData(ptr);
+    SetBlockUnused(curr);
+
+    // 相邻的空闲块先从各自的组中摘下，合并后再挂回
+    curr = CoalesceBlocks(space, curr, RemoveBlock);
+    InsertBlock(space, curr);
+}
+
+
+// 两级分组适应算法的接口
+const Allocator TlsfFit = { "tlsf", Initialize, Malloc, Free, NULL, RemoveBlock };
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // madvise
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+// the pages already read are dropped whenever this many bytes have piled up
+#define RELEASE_CHUNK (16 << 20)
+
+
+// Reads the next non-negative decimal integer, skipping any whitespace in
+// front of it. This is the whole grammar of the text trace, so it replaces
+// fscanf and its per-call locale and format handling. The mapping is not
+// NUL-terminated, so every read is checked against end.
+static bool ScanInt(TraceReader* r, long long* value)
+{
+    const char* p = r->p;
+    const char* end = r->end;
+    while(p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+        p++;
+    if(p == end || (unsigned)(*p - '0') > 9)
+        return false;
+
+    long long x = 0;
+    do
+        x = x * 10 + (*p++ - '0');
+    while(p < end && (unsigned)(*p - '0') <= 9);
+
+    r->p = p;
+    *value = x;
+    return true;
+}
+
+static bool ScanVarint(TraceReader* r, uint64_t* value)
+{
+    const unsigned char* p = (const unsigned char*) r->p;
+    const unsigned char* end = (const unsigned char*) r->end;
+    uint64_t x = 0;
+    for(int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        unsigned char b = *p++;
+        x |= (uint64_t)(b & 0x7F) << shift;
+        if(b < 0x80)
+        {
+            r->p = (const char*) p;
+            *value = x;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t LoadLE(const char* p, int bytes)
+{
+    uint64_t x = 0;
+    for(int i = bytes - 1; i >= 0; i--)
+        x = x << 8 | (unsigned char) p[i];
+    return x;
+}
+
+static void StoreLE(char* p, uint64_t x, int bytes)
+{
+    for(int i = 0; i < bytes; i++, x >>= 8)
+        p[i] = (char)(x & 0xFF);
+}
+
+static bool ReadHeader(TraceReader* r)
+{
+    if(r->end - r->p >= TRACE_HEADER_SIZE && memcmp(r->p, TRACE_MAGIC, 4) == 0)
+    {
+        if(LoadLE(r->p + 4, 4) != TRACE_VERSION)
+            return false;
+        r->binary = 1;
+        r->n = (long long) LoadLE(r->p + 8, 8);
+        r->L = (long long) LoadLE(r->p + 16, 8);
+        r->p += TRACE_HEADER_SIZE;
+        return r->n >= 0 && r->L >= 0;
+    }
+    r->binary = 0;
+    return ScanInt(r, &r->n) && ScanInt(r, &r->L);
+}
+
+
+int OpenTrace(const char* path, TraceReader* reader)
+{
+    memset(reader, 0, sizeof(TraceReader));
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return -1;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if(st.st_size == 0)
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+    // the file is read once from front to back
+    posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    reader->bytes = st.st_size;
+    reader->map = reader->released = reader->p = (const char*) map;
+    reader->end = reader->map + st.st_size;
+    if(!ReadHeader(reader))
+    {
+        CloseTrace(reader);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+// Drops the pages that have been read, so a long trace does not stay
+// resident behind the cursor.
+static void ReleaseRead(TraceReader* r)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    const char* upto = r->map + (r->p - r->map) / page * page;
+    // posix_madvise ignores POSIX_MADV_DONTNEED on glibc; the mapping is
+    // read-only, so the pages are simply read again if they are touched
+    madvise((void*) r->released, upto - r->released, MADV_DONTNEED);
+    r->released = upto;
+}
+
+int ReadRequest(TraceReader* reader, Request* req)
+{
+    if(reader->read == reader->n)
+        return 0;
+    if(reader->p - reader->released >= RELEASE_CHUNK)
+        ReleaseRead(reader);
+
+    if(reader->binary)
+    {
+        uint64_t delta, t, m;
+        if(!ScanVarint(reader, &delta) || !ScanVarint(reader, &t) || !ScanVarint(reader, &m))
+            return -1;
+        // zigzag: 0, -1, 1, -2, ... are stored as 0, 1, 2, 3, ...
+        reader->last += (long long)(delta >> 1) ^ -(long long)(delta & 1);
+        req->s = reader->last;
+        req->t = (long long) t;
+        req->m = (long long) m;
+    }
+    else if(!ScanInt(reader, &req->s) || !ScanInt(reader, &req->t) || !ScanInt(reader, &req->m))
+        return -1;
+
+    req->ptr = NULL;
+    reader->read++;
+    return 1;
+}
+
+void CloseTrace(TraceReader* reader)
+{
+    if(reader->map)
+        munmap((void*) reader->map, reader->bytes);
+    reader->map = reader->released = reader->p = reader->end = NULL;
+}
+
+
+static int PutVarint(FILE* file, uint64_t x)
+{
+    char buf[10];
+    int k = 0;
+    while(x >= 0x80)
+    {
+        buf[k++] = (char)((x & 0x7F) | 0x80);
+        x >>= 7;
+    }
+    buf[k++] = (char) x;
+    return fwrite(buf, 1, k, file) == (size_t) k ? 0 : -1;
+}
+
+int BeginTrace(TraceWriter* writer, FILE* file, long long n, long long L)
+{
+    char header[TRACE_HEADER_SIZE] = { 0 };
+    memcpy(header, TRACE_MAGIC, 4);
+    StoreLE(header + 4, TRACE_VERSION, 4);
+    StoreLE(header + 8, (uint64_t) n, 8);
+    StoreLE(header + 16, (uint64_t) L, 8);
+
+    writer->file = file;
+    writer->last = 0;
+    return fwrite(header, 1, TRACE_HEADER_SIZE, file) == TRACE_HEADER_SIZE ? 0 : -1;
+}
+
+int WriteRequest(TraceWriter* writer, const Request* req)
+{
+    long long delta = req->s - writer->last;
+    writer->last = req->s;
+    uint64_t zigzag = ((uint64_t) delta << 1) ^ (uint64_t)(delta >> 63);
+    if(PutVarint(writer->file, zigzag) < 0
+        || PutVarint(writer->file, (uint64_t) req->t) < 0
+        || PutVarint(writer->file, (uint64_t) req->m) < 0)
+        return -1;
+    return 0;
+}
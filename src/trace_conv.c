@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace.h"
+
+// Converts a trace to the binary format, see trace.h.
+// The input may be a text or a binary trace.
+//
+// usage: trace_conv input output
+
+int main(int argc, char** argv)
+{
+    if(argc != 3)
+    {
+        fprintf(stderr, "usage: %s input output\n", argv[0]);
+        return 1;
+    }
+
+    TraceReader reader;
+    if(OpenTrace(argv[1], &reader) < 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    FILE* output = fopen(argv[2], "wb");
+    if(output == NULL)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    TraceWriter writer;
+    Request req;
+    int r = 0;
+    if(BeginTrace(&writer, output, reader.n, reader.L) < 0)
+        r = -1;
+    while(r == 0 && (r = ReadRequest(&reader, &req)) == 1)
+        r = WriteRequest(&writer, &req);
+    if(r < 0)
+    {
+        fprintf(stderr, "%s: malformed trace or write error after %lld requests\n", argv[1], reader.read);
+        return 1;
+    }
+    long long size = ftell(output);
+    if(fclose(output) != 0)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    printf("%lld requests, %lld -> %lld bytes\n", reader.n, reader.bytes, size);
+    CloseTrace(&reader);
+    return 0;
+}
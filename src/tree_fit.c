@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "memana.h"
+
+#define dp(p) printf(#p " = %p\n", (p))
+#define dd(d) printf(#d " = %I64d\n", (d))
+#define ABS(size) ((size) >= 0 ? (size) : -(size))
+#define LEFT(pBlock) ((pBlock)->node.prev)
+#define RIGHT(pBlock) ((pBlock)->node.next)
+#define BLOCK_MIN_SIZE (sizeof(Block) + sizeof(BlockSize_t))
+
+// 用树实现的最佳适应
+// 空闲块按(大小, 地址)组织成一棵树堆(treap)，树的左右孩子直接复用块里链表节点的prev/next，
+// 所以不需要额外的内存。树根保存在原来空闲链表表头的位置。
+// 树堆的优先级由块的地址散列得到，同样不需要额外保存。
+// 查找最佳适应的块、插入、删除的期望时间都是O(log n)。
+
+
+// 块的优先级，堆序要求父节点的优先级不小于孩子
+static uint64_t Priority(Block* p)
+{
+    return ((uint64_t)(uintptr_t)p >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+// 按(大小, 地址)比较两个块
+static int Less(Block* a, Block* b)
+{
+    if(a->size != b->size)
+        return a->size < b->size;
+    return (char*)a < (char*)b;
+}
+
+// 将空闲块插入树中
+static void InsertBlock(void* space, Block* curr)
+{
+    // 沿着查找路径往下走，直到遇到优先级比当前块低的节点
+    Block** link = GetPtrToHeadPtr(space);
+    uint64_t priority = Priority(curr);
+    while(*link && Priority(*link) >= priority)
+    {
+        STAT(visited);
+        link = Less(curr, *link) ? &LEFT(*link) : &RIGHT(*link);
+    }
+
+    // 把这个节点为根的子树按当前块拆成左右两半，分别作为当前块的左右子树
+    Block* t = *link;
+    Block** l = &LEFT(curr);
+    Block** r = &RIGHT(curr);
+    while(t)
+    {
+        STAT(visited);
+        if(Less(t, curr))
+        {
+            *l = t;
+            l = &RIGHT(t);
+            t = RIGHT(t);
+        }
+        else
+        {
+            *r = t;
+            r = &LEFT(t);
+            t = LEFT(t);
+        }
+    }
+    *l = NULL;
+    *r = NULL;
+    *link = curr;
+}
+
+// 将空闲块从树中摘下
+static void RemoveBlock(void* space, Block* curr)
+{
+    // 找到指向当前块的那个指针
+    Block** link = GetPtrToHeadPtr(space);
+    while(*link != curr)
+    {
+        assert(*link != NULL);
+        STAT(visited);
+        link = Less(curr, *link) ? &LEFT(*link) : &RIGHT(*link);
+    }
+
+    // 把左右子树按优先级合并起来，代替当前块的位置
+    Block* a = LEFT(curr);
+    Block* b = RIGHT(curr);
+    while(a && b)
+    {
+        STAT(visited);
+        if(Priority(a) >= Priority(b))
+        {
+            *link = a;
+            link = &RIGHT(a);
+            a = RIGHT(a);
+        }
+        else
+        {
+            *link = b;
+            link = &LEFT(b);
+            b = LEFT(b);
+        }
+    }
+    *link = a ? a : b;
+}
+
+// 找到能放下size的最小的块，找不到时返回NULL
+static Block* FindBestBlock(void* space, BlockSize_t size)
+{
+    Block* best = NULL;
+    Block* p = *GetPtrToHeadPtr(space);
+    while(p)
+    {
+        STAT(visited);
+        if(p->size >= size)
+        {
+            best = p;
+            p = LEFT(p);
+        }
+        else
+            p = RIGHT(p);
+    }
+    return best;
+}
+
+
+// 初始化内存，整个内存作为一个空闲块，也是树根
+static void Initialize(void* space, BlockSize_t size)
+{
+    Block* pBlock = InitializeSpace(space, size, 0);
+    *GetPtrToHeadPtr(space) = NULL;
+    InsertBlock(space, pBlock);
+}
+
+
+static void* Malloc(void* space, BlockSize_t size)
+{
+    // 按对齐要求取整，块被释放后也要放得下链表节点
+    size = AlignSize(size);
+
+    Block* p = FindBestBlock(space, size);
+    if(p == NULL)
+        return NULL;
+
+    // 把块从树中摘下，多余的部分拆成一个新的空闲块插回树中
+    RemoveBlock(space, p);
+    Block* rest = SplitBlock(p, size);
+    if(rest)
+        InsertBlock(space, rest);
+
+    SetBlockUsed(p);
+    return (void*) p->data;
+}
+
+static void Free(void* space, void* ptr)
+{
+    if(ptr == NULL)
+        return;
+
+    // 找到分配出去的这个块，并设置为未使用
+    Block* curr = SeekBlockFromData(ptr);
+    SetBlockUnused(curr);
+
+    // 块的大小是树的键，所以相邻的空闲块要先从树中摘下，合并后再插回
+    curr = CoalesceBlocks(space, curr, RemoveBlock);
+    InsertBlock(space, curr);
+}
+
+
+// 用树实现的最佳适应算法的接口
+const Allocator TreeFit = { "tree", Initialize, Malloc, Free, NULL, RemoveBlock };
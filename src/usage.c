@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "usage.h"
+
+#define ABS(size) ((size) >= 0 ? (size) : -(size))
+#define TAGS_SIZE (2 * sizeof(BlockSize_t))
+
+
+static int Bucket(BlockSize_t size)
+{
+    if(size < USAGE_SUB)
+        return (int) size;
+    int shift = 63 - __builtin_clzll((unsigned long long) size) - USAGE_SUB_BITS;
+    return shift * USAGE_SUB + (int)(size >> shift);
+}
+
+// 从largest所在的分组往下找最高的非空分组，重新得到largest
+// 组里只有一块时它的字节数就是准确值，否则用平均大小估计
+static void Estimate(Usage* u)
+{
+    int i = Bucket(u->largest);
+    while(i >= 0 && u->counts[i] == 0)
+        i--;
+    if(i < 0)
+    {
+        u->largest = 0;
+        u->largestBlocks = 0;
+        return;
+    }
+    u->largest = u->bytes[i] / u->counts[i];
+    u->largestBlocks = u->counts[i] == 1;
+}
+
+static void AddFree(Usage* u, BlockSize_t size)
+{
+    int i = Bucket(size);
+    u->freeBytes += size;
+    u->freeBlocks++;
+    u->counts[i]++;
+    u->bytes[i] += size;
+    // largest是估计值时，只有更高分组里的块才确定是最大的
+    if(u->largestBlocks > 0 ? size > u->largest : (i > Bucket(u->largest) || u->freeBlocks == 1))
+    {
+        u->largest = size;
+        u->largestBlocks = 1;
+    }
+    else if(u->largestBlocks > 0 && size == u->largest)
+        u->largestBlocks++;
+    else if(u->largestBlocks == 0 && i == Bucket(u->largest))
+        Estimate(u);
+}
+
+static void RemoveFree(Usage* u, BlockSize_t size)
+{
+    int i = Bucket(size);
+    u->freeBytes -= size;
+    u->freeBlocks--;
+    u->counts[i]--;
+    u->bytes[i] -= size;
+    if(u->largestBlocks > 0 ? size == u->largest && --u->largestBlocks == 0 : i == Bucket(u->largest))
+        Estimate(u);
+}
+
+
+void InitializeUsage(Usage* u, const Allocator* a, void* space)
+{
+    if(a->lazyMerge || a->Walk)
+    {
+        u->walk = a;
+        RecountUsage(u, space);
+        return;
+    }
+    memset(u, 0, sizeof(Usage));
+    Block* first = SeekFirstBlock(space);
+    assert(first->size > 0);
+    AddFree(u, first->size);
+    u->headerBytes = (char*)first - (char*)space + TAGS_SIZE;
+}
+
+// 统计一个数据区大小为size的块
+static void Count(void* ctx, void* data, BlockSize_t size, bool used)
+{
+    Usage* u = (Usage*) ctx;
+    if(used)
+    {
+        u->usedBytes += size;
+        u->usedBlocks++;
+    }
+    else
+        AddFree(u, size);
+}
+
+void RecountUsage(Usage* u, void* space)
+{
+    const Allocator* walk = u->walk;
+    memset(u, 0, sizeof(Usage));
+    u->walk = walk;
+    Block* p = SeekFirstBlock(space);
+    char* end = (char*) Seek(p, GetSpaceSize(space));
+    if(walk && walk->Walk)
+        walk->Walk(space, Count, u);
+    else
+        for(; (char*)p < end; p = (Block*) Seek(p, ABS(p->size) + TAGS_SIZE))
+            Count(u, p->data, ABS(p->size), p->size < 0);
+    // 除了数据区都算作头部
+    u->headerBytes = end - (char*)space - u->usedBytes - u->freeBytes;
+}
+
+void RefreshUsage(Usage* u, void* space)
+{
+    if(u->walk)
+        RecountUsage(u, space);
+}
+
+void TrackMalloc(Usage* u, void* space, void* ptr)
+{
+    if(ptr == NULL || u->walk)
+        return;
+
+    // 分配前这里是一个空闲块，拆分时剩下的部分紧跟在后面
+    Block* p = SeekBlockFromData(ptr);
+    BlockSize_t size = ABS(p->size);
+    Block* rest = SeekNextBlock(space, p);
+    if(rest)
+    {
+        RemoveFree(u, size + TAGS_SIZE + rest->size);
+        AddFree(u, rest->size);
+        u->headerBytes += TAGS_SIZE;
+    }
+    else
+        RemoveFree(u, size);
+
+    u->usedBytes += size;
+    u->usedBlocks++;
+}
+
+void TrackFree(Usage* u, void* space, void* ptr)
+{
+    if(ptr == NULL || u->walk)
+        return;
+
+    // 释放后这个块会和两边的空闲块合并成一个
+    Block* p = SeekBlockFromData(ptr);
+    BlockSize_t size = ABS(p->size);
+    BlockSize_t merged = size;
+    Block* prev = SeekPrevBlock(space, p);
+    Block* next = SeekNextBlock(space, p);
+    if(prev)
+    {
+        RemoveFree(u, prev->size);
+        merged += TAGS_SIZE + prev->size;
+        u->headerBytes -= TAGS_SIZE;
+    }
+    if(next)
+    {
+        RemoveFree(u, next->size);
+        merged += TAGS_SIZE + next->size;
+        u->headerBytes -= TAGS_SIZE;
+    }
+    AddFree(u, merged);
+
+    u->usedBytes -= size;
+    u->usedBlocks--;
+}
+
+void TrackBatch(void* ctx, void* space, void* ptr, BatchEvent event)
+{
+    Usage* u = (Usage*) ctx;
+    if(u->walk)
+        return;
+    if(event == BATCH_MALLOC)
+        TrackMalloc(u, space, ptr);
+    else if(event == BATCH_FREE)
+        TrackFree(u, space, ptr);
+    // 切开和连起来都只是两个块之间的首尾size在头部和数据区之间转移
+    else if(event == BATCH_CUT)
+    {
+        u->usedBytes -= TAGS_SIZE;
+        u->usedBlocks++;
+        u->headerBytes += TAGS_SIZE;
+    }
+    else
+    {
+        u->usedBytes += TAGS_SIZE;
+        u->usedBlocks--;
+        u->headerBytes -= TAGS_SIZE;
+    }
+}
+
+BlockSize_t UsageLargest(const Usage* u, const Allocator* a, void* space)
+{
+    if(a->Largest)
+        return a->Largest(space);
+    return u->largest;
+}
+
+double UsageFragmentation(const Usage* u, const Allocator* a, void* space)
+{
+    if(u->freeBytes == 0)
+        return 0;
+    return 1 - (double) UsageLargest(u, a, space) / u->freeBytes;
+}